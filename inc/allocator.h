@@ -0,0 +1,187 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+/*
+ *  Purpose:
+ *      Trees allocate thousands of nodes and keys of the same size and
+ *      free them all at once. An arena hands out memory by bumping a
+ *      pointer and is released as a whole, a slab keeps objects of one
+ *      size in big page aligned chunks. Both take their memory straight
+ *      from mmap, optionally in huge pages and locked in RAM (mlock) so
+ *      private keys are never written to swap.
+ */
+
+#define ALLOC_DEFAULT 0
+#define ALLOC_HUGE_PAGES 1
+#define ALLOC_LOCKED 2
+
+typedef struct Arena arena_t;
+typedef struct Slab slab_t;
+
+/*
+ * @Function:
+ *  alloc_pages
+ *
+ * @Description:
+ *  Maps zeroed memory. With ALLOC_HUGE_PAGES it tries explicit huge pages
+ *  and falls back to asking for transparent ones, with ALLOC_LOCKED the
+ *  pages are locked in RAM when the limits allow it.
+ *
+ * @Parameters:
+ *  The size in bytes and the flags.
+ *
+ * @Returns: The memory, or NULL if it couldn't be mapped.
+ */
+void* alloc_pages(size_t size, int flags);
+
+/*
+ * @Function:
+ *  free_pages
+ *
+ * @Description:
+ *  Unmaps memory from alloc_pages.
+ *
+ * @Parameters:
+ *  The memory, the size and the flags it was allocated with.
+ *
+ * @Returns: None
+ */
+void free_pages(void *pages, size_t size, int flags);
+
+/*
+ * @Function:
+ *  create_arena
+ *
+ * @Description:
+ *  Creates a bump allocator. A chunk big enough for everything that'll
+ *  be allocated makes arena_alloc never map again.
+ *
+ * @Parameters:
+ *  The size of each chunk and the flags of alloc_pages.
+ *
+ * @Returns: The arena, or NULL if it couldn't be allocated.
+ */
+arena_t* create_arena(size_t chunk_size, int flags);
+
+/*
+ * @Function:
+ *  arena_alloc
+ *
+ * @Description:
+ *  Returns zeroed memory aligned to 16 bytes. It's only given back when
+ *  the arena is freed.
+ *
+ * @Parameters:
+ *  The arena and the size.
+ *
+ * @Returns: The memory, or NULL if a new chunk couldn't be mapped.
+ */
+void* arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * @Function:
+ *  arena_mapped
+ *
+ * @Description:
+ *  Returns how many bytes the arena has mapped.
+ *
+ * @Parameters:
+ *  The arena.
+ *
+ * @Returns: The size of all its chunks.
+ */
+size_t arena_mapped(arena_t *arena);
+
+/*
+ * @Function:
+ *  free_arena
+ *
+ * @Description:
+ *  Releases every chunk of the arena at once.
+ *
+ * @Parameters:
+ *  The arena.
+ *
+ * @Returns: None
+ */
+void free_arena(arena_t *arena);
+
+/*
+ * @Function:
+ *  create_slab
+ *
+ * @Description:
+ *  Creates an allocator of fixed size objects. Objects are page aligned
+ *  when their size is a multiple of the page size (like the 16 KB key
+ *  and the 32 KB key pair).
+ *
+ * @Parameters:
+ *  The size of the objects, how many objects each chunk holds and the
+ *  flags of alloc_pages.
+ *
+ * @Returns: The slab, or NULL if it couldn't be allocated.
+ */
+slab_t* create_slab(size_t object_size, uint32_t per_chunk, int flags);
+
+/*
+ * @Function:
+ *  slab_alloc
+ *
+ * @Description:
+ *  Returns an object, reusing freed ones first.
+ *
+ * @Parameters:
+ *  The slab.
+ *
+ * @Returns: The object, or NULL if a new chunk couldn't be mapped.
+ */
+void* slab_alloc(slab_t *slab);
+
+/*
+ * @Function:
+ *  slab_free
+ *
+ * @Description:
+ *  Gives an object back to the slab.
+ *
+ * @Parameters:
+ *  The slab and the object.
+ *
+ * @Returns: None
+ */
+void slab_free(slab_t *slab, void *object);
+
+/*
+ * @Function:
+ *  slab_discard
+ *
+ * @Description:
+ *  Wipes an object that will never be used again and, when it covers
+ *  whole pages, gives its pages back to the system (they read as zeros
+ *  if touched again). The object isn't reused by slab_alloc.
+ *
+ * @Parameters:
+ *  The slab and the object.
+ *
+ * @Returns: 1 if the pages were released, 0 if the object was only wiped.
+ */
+int slab_discard(slab_t *slab, void *object);
+
+/*
+ * @Function:
+ *  free_slab
+ *
+ * @Description:
+ *  Releases every chunk of the slab at once.
+ *
+ * @Parameters:
+ *  The slab.
+ *
+ * @Returns: None
+ */
+void free_slab(slab_t *slab);
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef HYPERTREE_H
+#define HYPERTREE_H
+
+#include "stdint.h"
+
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      One tree has to generate every key it'll ever use before the first
+ *      signature. A hypertree stacks small trees in layers: the leaves of
+ *      the top tree sign the roots of the trees in the layer below, and
+ *      only the bottom trees sign messages. Lower trees are generated when
+ *      they're first needed, so only the top tree is built up front and
+ *      the published root never changes, while the budget is
+ *      n_messages^layers signatures (256 messages and 5 layers give 2^40).
+ *
+ *  Layout of a hypertree signature:
+ *      |layers (1 byte)|size (2 bytes)|merkle signature| ... one size and
+ *      merkle signature per layer, from the bottom tree to the top tree ...|
+ *
+ *      The merkle signature of the bottom tree signs the message, the one
+ *      of each layer above signs the root of the tree below it, written
+ *      in hexadecimal.
+ */
+
+#define MAX_LAYERS 8
+
+typedef struct Hypertree hypertree;
+typedef struct Hyper_sign hyper_sign;
+
+/*
+ * @Function:
+ *  build_hypertree
+ *
+ * @Description:
+ *  Builds the top tree. The lower layers are built by the first
+ *  signature.
+ *
+ * @Parameters:
+ *  The number of layers (at most MAX_LAYERS) and the number of messages
+ *  each tree can sign (must be a power of two).
+ *
+ * @Returns: The hypertree, or NULL if the number of layers is invalid.
+ */
+hypertree* build_hypertree(uint8_t layers, uint16_t n_messages);
+
+/*
+ * @Function:
+ *  build_hypertree_seeded
+ *
+ * @Description:
+ *  Same as build_hypertree, but every tree is built with
+ *  build_tree_seeded, from a seed derived from the seed, the layer and
+ *  the number of trees the layer had before. The same seed always gives
+ *  the same trees in the same order, with or without pipelines.
+ *
+ * @Parameters:
+ *  The number of layers, the number of messages of each tree and the
+ *  seed (SHA256_DIGEST_LENGTH bytes, copied).
+ *
+ * @Returns: The hypertree, or NULL if the number of layers is invalid.
+ */
+hypertree* build_hypertree_seeded(uint8_t layers, uint16_t n_messages, uint8_t *seed);
+
+/*
+ * @Function:
+ *  hypertree_signature
+ *
+ * @Description:
+ *  Signs the message with the next key of the bottom tree. When a tree
+ *  runs out of keys a new one takes its place and its root is signed by
+ *  the layer above.
+ *
+ * @Parameters:
+ *  The hypertree and the message to sign.
+ *
+ * @Returns: The hypertree signature, or NULL if the top tree is exhausted.
+ */
+hyper_sign* hypertree_signature(hypertree *tree, char *message);
+
+/*
+ * @Function:
+ *  verify_hyper_prove
+ *
+ * @Description:
+ *  Climbs the layers of the signature, each one proving the root of the
+ *  layer below, and checks that the last root is the public hash.
+ *
+ * @Parameters:
+ *  Public hash, the message and the hypertree signature.
+ *
+ * @Returns: true or false if the signature matchs or not.
+ */
+uint8_t verify_hyper_prove(uint8_t *pub, char *message, hyper_sign *signature);
+
+/*
+ * @Function:
+ *  verify_hyper_prove_bytes
+ *
+ * @Description:
+ *  Same as verify_hyper_prove, for a signature that was read or received
+ *  as raw bytes.
+ *
+ * @Parameters:
+ *  Public hash, the message, the bytes of the signature and their size.
+ *
+ * @Returns: true or false if the signature matchs or not.
+ */
+uint8_t verify_hyper_prove_bytes(uint8_t *pub, char *message, uint8_t *bytes, uint32_t size);
+
+/*
+ * @Function:
+ *  get_hyper_sign_bytes
+ *
+ * @Description:
+ *  Returns the bytes of the signature, laid out as described above, to
+ *  store or send them.
+ *
+ * @Parameters:
+ *  The hypertree signature and where to store its size.
+ *
+ * @Returns: The bytes, owned by the signature.
+ */
+uint8_t* get_hyper_sign_bytes(hyper_sign *signature, uint32_t *size);
+
+/*
+ * @Function:
+ *  get_hyper_sign_leaves
+ *
+ * @Description:
+ *  Hashes, for every layer from the bottom up, the public key of the leaf
+ *  that signed and its Lamport signature. The bottom leaf signed the
+ *  message, the others the root of the tree below. A leaf that shows up
+ *  again with another signature hash reused its key.
+ *
+ * @Parameters:
+ *  The hypertree signature and where to store the leaf hashes and the
+ *  signature hashes (MAX_LAYERS*SHA256_DIGEST_LENGTH bytes each).
+ *
+ * @Returns: The number of layers, or 0 if the signature is malformed.
+ */
+int get_hyper_sign_leaves(hyper_sign *signature, uint8_t *leaf_hashes, uint8_t *sign_hashes);
+
+/*
+ * @Function:
+ *  hypertree_use_pipeline
+ *
+ * @Description:
+ *  Starts a key pipeline for every layer below the top one, so the trees
+ *  that replace exhausted ones are built in the background and signing
+ *  doesn't stop to generate keys.
+ *
+ * @Parameters:
+ *  The hypertree and the low and high water marks of the pipelines
+ *  (see key_pipeline.h).
+ *
+ * @Returns: 1 if every pipeline was started, 0 otherwise.
+ */
+int hypertree_use_pipeline(hypertree *tree, uint16_t low_water, uint8_t high_water);
+
+/*
+ * @Function:
+ *  hypertree_set_lookahead
+ *
+ * @Description:
+ *  Sets the lookahead (see set_tree_lookahead) of the tree of every
+ *  layer, and of the trees that will replace them.
+ *
+ * @Parameters:
+ *  The hypertree and the number of signatures kept ready per tree.
+ *
+ * @Returns: None
+ */
+void hypertree_set_lookahead(hypertree *tree, uint16_t depth);
+
+/*
+ * @Function:
+ *  hypertree_precompute
+ *
+ * @Description:
+ *  Prepares the next signatures of every layer, the bottom one first,
+ *  for when the signer is idle.
+ *
+ * @Parameters:
+ *  The hypertree and the most signatures to prepare (0 for all of them).
+ *
+ * @Returns: The number of signatures prepared, 0 when they're all ready.
+ */
+int hypertree_precompute(hypertree *tree, int max);
+
+/*
+ * @Function:
+ *  get_hypertree_public_hash
+ *
+ * @Description:
+ *  Returns the public hash, the root of the top tree.
+ *
+ * @Parameters:
+ *  The hypertree.
+ *
+ * @Returns: The hash.
+ */
+uint8_t* get_hypertree_public_hash(hypertree *tree);
+
+/*
+ * @Function:
+ *  free_hyper_signature
+ *
+ * @Description:
+ *  Free the signature within the structure and the structure pointer
+ *
+ * @Parameters:
+ *  Hypertree signature.
+ *
+ * @Returns: None
+ */
+void free_hyper_signature(hyper_sign *signature);
+
+/*
+ * @Function:
+ *  free_hypertree
+ *
+ * @Description:
+ *  Frees the trees of every layer and the signatures of their roots.
+ *
+ * @Parameters:
+ *  The hypertree.
+ *
+ * @Returns: None
+ */
+void free_hypertree(hypertree *tree);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef KEY_PIPELINE_H
+#define KEY_PIPELINE_H
+
+#include "stdint.h"
+
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      Building a tree generates every one of its keys, which takes far
+ *      longer than a signature. The pipeline builds the next trees on a
+ *      background thread, so when the signer runs out of keys a ready
+ *      tree is handed over instead of being built on the spot.
+ *
+ *      There's always one spare tree being kept ready. Once the signer
+ *      reports that its tree has low_water keys or less left, trees are
+ *      built until high_water of them are waiting.
+ */
+
+typedef struct Key_pipeline key_pipeline;
+
+/*
+ * @Function:
+ *  create_key_pipeline
+ *
+ * @Description:
+ *  Starts the thread that builds the trees.
+ *
+ * @Parameters:
+ *  The number of messages of each tree (must be a power of two), the
+ *  low water mark (keys left in the signer's tree) and the high water
+ *  mark (trees kept ready, at least one).
+ *
+ * @Returns: The pipeline, or NULL if the thread couldn't be started.
+ */
+key_pipeline* create_key_pipeline(uint16_t n_messages, uint16_t low_water, uint8_t high_water);
+
+/*
+ * @Function:
+ *  create_key_pipeline_seeded
+ *
+ * @Description:
+ *  Same as create_key_pipeline, but the trees are built with
+ *  build_tree_seeded. The i-th tree handed over comes from the seed
+ *  derived with index first + i, whatever the timing of the builder.
+ *
+ * @Parameters:
+ *  The number of messages of each tree, the low and high water marks,
+ *  the seed (SHA256_DIGEST_LENGTH bytes, copied) and the index of the
+ *  first tree.
+ *
+ * @Returns: The pipeline, or NULL if the thread couldn't be started.
+ */
+key_pipeline* create_key_pipeline_seeded(uint16_t n_messages, uint16_t low_water, uint8_t high_water,
+    uint8_t *seed, uint32_t first);
+
+/*
+ * @Function:
+ *  key_pipeline_take
+ *
+ * @Description:
+ *  Hands a ready tree over to the signer, who owns it from now on. Only
+ *  waits when no tree is ready, which is counted as a stall.
+ *
+ * @Parameters:
+ *  The pipeline.
+ *
+ * @Returns: A tree with all its keys available.
+ */
+tree_t* key_pipeline_take(key_pipeline *pipeline);
+
+/*
+ * @Function:
+ *  key_pipeline_report
+ *
+ * @Description:
+ *  Tells the pipeline how many keys the signer's tree has left, waking
+ *  the builder when it's at the low water mark or below.
+ *
+ * @Parameters:
+ *  The pipeline and the number of keys left.
+ *
+ * @Returns: None
+ */
+void key_pipeline_report(key_pipeline *pipeline, uint32_t remaining);
+
+/*
+ * @Function:
+ *  key_pipeline_stats
+ *
+ * @Description:
+ *  Reads how many trees were built, how many are ready and how many
+ *  times key_pipeline_take had to wait.
+ *
+ * @Parameters:
+ *  The pipeline and where to store the counters (any may be NULL).
+ *
+ * @Returns: None
+ */
+void key_pipeline_stats(key_pipeline *pipeline, uint64_t *built, uint32_t *ready, uint64_t *stalls);
+
+/*
+ * @Function:
+ *  free_key_pipeline
+ *
+ * @Description:
+ *  Stops the builder thread and frees the trees that weren't taken.
+ *
+ * @Parameters:
+ *  The pipeline.
+ *
+ * @Returns: None
+ */
+void free_key_pipeline(key_pipeline *pipeline);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef MERKLE_TREE_H
 #define MERKLE_TREE_H
 
+#include <stddef.h>
 #include "stdint.h"
 
 #define KEY_AVAILABLE 1
@@ -32,6 +33,38 @@ typedef struct Merkle_sign merkle_sign;
  */
 tree_t* build_tree(uint16_t n_messages);
 
+/*
+ * @Function:
+ *  build_tree_flags
+ *
+ * @Description:
+ *  Same as build_tree, with the flags of alloc_pages (see allocator.h)
+ *  for the memory of the tree. ALLOC_LOCKED only applies to the keys.
+ *
+ * @Parameters:
+ *  The number of messages (must be a power of two) and the flags.
+ *
+ * @Returns: The merkle tree.
+ */
+tree_t* build_tree_flags(uint16_t n_messages, int flags);
+
+/*
+ * @Function:
+ *  build_tree_seeded
+ *
+ * @Description:
+ *  Same as build_tree, but the key of leaf i comes from the seed derived
+ *  with index i (see GenerateKeysFromSeed), so the same seed always gives
+ *  the same tree and rand() isn't used.
+ *
+ * @Parameters:
+ *  The number of messages (must be a power of two) and the seed
+ *  (SHA256_DIGEST_LENGTH bytes).
+ *
+ * @Returns: The merkle tree.
+ */
+tree_t* build_tree_seeded(uint16_t n_messages, uint8_t *seed);
+
 /*
  * @Function:
  *  node_set_leaf
@@ -136,6 +169,74 @@ void print_tree(node_t *node);
  */
 merkle_sign* merkle_signature(tree_t *tree, char *message);
 
+/*
+ * @Function:
+ *  merkle_signature_leaf
+ *
+ * @Description:
+ *  Same as merkle_signature, but with the key of a given leaf. Only that
+ *  leaf is touched, so different leaves can be signed from different
+ *  threads at the same time.
+ *
+ * @Parameters:
+ *  The tree, the index of the leaf (left to right) and the message to sign
+ *
+ * @Returns: The merkle signature, or NULL if the key was already used.
+ */
+merkle_sign* merkle_signature_leaf(tree_t *tree, int index, char *message);
+
+/*
+ * @Function:
+ *  set_tree_lookahead
+ *
+ * @Description:
+ *  Sets how many signatures of the next leaves precompute_signatures may
+ *  keep ready. A ready signature already has the public key and the path
+ *  of its leaf, so merkle_signature only has to sign the message. The
+ *  ones prepared before are dropped. The default is 0, nothing prepared.
+ *
+ * @Parameters:
+ *  The tree and the number of signatures.
+ *
+ * @Returns: None
+ */
+void set_tree_lookahead(tree_t *tree, uint16_t depth);
+
+/*
+ * @Function:
+ *  precompute_signatures
+ *
+ * @Description:
+ *  Prepares the signatures of the next leaves, up to the lookahead, to be
+ *  called when the signer has nothing else to do. Neither this nor
+ *  merkle_signature may run while another thread signs with the tree.
+ *
+ * @Parameters:
+ *  The tree and the most signatures to prepare in this call (0 to fill
+ *  the lookahead).
+ *
+ * @Returns: The number of signatures prepared, 0 when they're all ready.
+ */
+int precompute_signatures(tree_t *tree, int max);
+
+/*
+ * @Function:
+ *  get_tree_memory
+ *
+ * @Description:
+ *  Reports the memory of the tree. The key pair of a leaf is wiped and
+ *  given back as soon as the leaf signs, so the live memory shrinks as
+ *  the tree is used. Keys whose pages couldn't be given back (see
+ *  slab_discard) are wiped but still counted as live.
+ *
+ * @Parameters:
+ *  The tree and where to store the live and reclaimed bytes (either may
+ *  be NULL).
+ *
+ * @Returns: None
+ */
+void get_tree_memory(tree_t *tree, size_t *live, size_t *reclaimed);
+
 /*
  * @Function:
  *  construct_signature
@@ -164,12 +265,77 @@ void construct_signature(uint8_t *pub_hash, node_t *node, merkle_sign *sign);
  */
 uint8_t verify_prove(uint8_t *pub, char* message, merkle_sign* signature);
 
+/*
+ * @Function:
+ *  verify_prove_leaf.
+ *
+ * @Description:
+ *  Same as verify_prove, but also hands back the hash of the leaf public
+ *  key, which identifies the one-time key used by the signature.
+ *
+ * @Parameters:
+ *  Public key, the message, the merkle signature and where to store the
+ *  leaf hash (SHA256_DIGEST_LENGTH bytes, may be NULL).
+ *
+ * @Returns: true or false if the signature matchs or not.
+ */
+uint8_t verify_prove_leaf(uint8_t *pub, char* message, merkle_sign* signature, uint8_t *leaf_hash);
+
+/*
+ * @Function:
+ *  prove_root.
+ *
+ * @Description:
+ *  Checks the Lamport signature and climbs the path of the merkle
+ *  signature, giving back the root it leads to. Used when the root isn't
+ *  known in advance, like for the lower trees of a hypertree.
+ *
+ * @Parameters:
+ *  The message, the merkle signature, where to store the leaf hash (may
+ *  be NULL) and where to store the root (SHA256_DIGEST_LENGTH bytes).
+ *
+ * @Returns: true or false if the Lamport signature matchs or not.
+ */
+uint8_t prove_root(char* message, merkle_sign* signature, uint8_t *leaf_hash, uint8_t *root);
+
+/*
+ * @Function:
+ *  get_merkle_sign_bytes
+ *
+ * @Description:
+ *  Returns the bytes of the signature, to store or send them.
+ *
+ * @Parameters:
+ *  The merkle signature and where to store its size.
+ *
+ * @Returns: The bytes, owned by the signature.
+ */
+uint8_t* get_merkle_sign_bytes(merkle_sign *signature, uint16_t *size);
+
+/*
+ * @Function:
+ *  copy_merkle_signature
+ *
+ * @Description:
+ *  Copies stored bytes into a signature that can be verified. Passing the
+ *  signature of the last call reuses its buffer, so a loop over many
+ *  stored signatures doesn't allocate.
+ *
+ * @Parameters:
+ *  The signature to reuse (or NULL for a new one), the bytes and their
+ *  size.
+ *
+ * @Returns: The signature, free it with free_merkle_signature.
+ */
+merkle_sign* copy_merkle_signature(merkle_sign *signature, uint8_t *bytes, uint16_t size);
+
 /*
  * @Function:
  *  free_merkle_signature;
  *
  * @Description:
- *  Free the signature within the structure and the structure pointer
+ *  Gives the signature back to the pool of signature buffers of the
+ *  calling thread, or frees it when the pool is full.
  *
  * @Parameters:
  *  Merkle signature.
@@ -183,7 +349,7 @@ void free_merkle_signature(merkle_sign* signature);
  *  free_tree;
  *
  * @Description:
- *  Chop the tree
+ *  Chop the tree, releasing its nodes and keys at once.
  *
  * @Parameters:
  *  Tree.
@@ -197,7 +363,8 @@ void free_tree(tree_t *tree);
  *  free_node;
  *
  * @Description:
- *  Delete the whole tree.
+ *  Delete the whole tree, for nodes allocated one by one with malloc.
+ *  Trees from build_tree are freed with free_tree.
  *
  * @Parameters:
  *  Root node.
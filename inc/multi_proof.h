@@ -0,0 +1,132 @@
+#ifndef MULTI_PROOF_H
+#define MULTI_PROOF_H
+
+#include "stdint.h"
+
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      Signing a batch of messages with one merkle signature each repeats
+ *      the hashes near the root in every signature. A multi proof carries
+ *      the Lamport signatures and public keys of the whole batch and only
+ *      the sibling hashes that can't be computed from the batch itself.
+ *
+ *  Layout:
+ *      |depth (1 byte)|count (2 bytes)|leaf indexes (4 bytes each, ascending)|
+ *      |Lamport signature|public key| ... one pair per message ...|
+ *      |sibling hashes, level by level from the leaves, left to right|
+ */
+
+typedef struct Multi_sign multi_sign;
+
+/*
+ * @Function:
+ *  merkle_multi_signature
+ *
+ * @Description:
+ *  Signs every message with its own available key and builds the multi
+ *  proof for all of them.
+ *
+ * @Parameters:
+ *  The tree, the messages and how many there are.
+ *
+ * @Returns: The multi signature or NULL if there aren't enough keys left.
+ */
+multi_sign* merkle_multi_signature(tree_t *tree, char **messages, uint16_t n_messages);
+
+/*
+ * @Function:
+ *  verify_multi_prove
+ *
+ * @Description:
+ *  Checks every Lamport signature and rebuilds the tree from the leaves
+ *  of the batch, computing each shared node once.
+ *
+ * @Parameters:
+ *  Public key, the messages (in the order they were signed), how many
+ *  there are and the multi signature. A proof for another number of
+ *  messages is rejected.
+ *
+ * @Returns: true or false if the whole batch matchs or not.
+ */
+uint8_t verify_multi_prove(uint8_t *pub, char **messages, uint16_t n_messages, multi_sign *signature);
+
+/*
+ * @Function:
+ *  verify_multi_prove_bytes
+ *
+ * @Description:
+ *  Same as verify_multi_prove, for a multi proof that was read or
+ *  received as raw bytes. Proofs cut short or with extra bytes are
+ *  rejected.
+ *
+ * @Parameters:
+ *  Public key, the messages, how many there are, the bytes of the multi
+ *  proof and their size.
+ *
+ * @Returns: true or false if the whole batch matchs or not.
+ */
+uint8_t verify_multi_prove_bytes(uint8_t *pub, char **messages, uint16_t n_messages, uint8_t *bytes,
+    uint32_t size);
+
+/*
+ * @Function:
+ *  get_multi_sign_hashes
+ *
+ * @Description:
+ *  Returns how many sibling hashes the multi proof carries.
+ *
+ * @Parameters:
+ *  The multi signature.
+ *
+ * @Returns: The number of hashes.
+ */
+uint32_t get_multi_sign_hashes(multi_sign *signature);
+
+/*
+ * @Function:
+ *  get_multi_sign_bytes
+ *
+ * @Description:
+ *  Returns the bytes of the multi proof, laid out as described above, to
+ *  store or publish them.
+ *
+ * @Parameters:
+ *  The multi signature and where to store its size.
+ *
+ * @Returns: The bytes, owned by the signature.
+ */
+uint8_t* get_multi_sign_bytes(multi_sign *signature, uint32_t *size);
+
+/*
+ * @Function:
+ *  copy_multi_signature
+ *
+ * @Description:
+ *  Copies stored bytes into a multi signature. Passing the signature of
+ *  the last call reuses it.
+ *
+ * @Parameters:
+ *  The signature to reuse (or NULL for a new one), the bytes and their
+ *  size.
+ *
+ * @Returns: The signature, free it with free_multi_signature.
+ */
+multi_sign* copy_multi_signature(multi_sign *signature, uint8_t *bytes, uint32_t size);
+
+/*
+ * @Function:
+ *  free_multi_signature
+ *
+ * @Description:
+ *  Free the signature within the structure and the structure pointer
+ *
+ * @Parameters:
+ *  Multi signature.
+ *
+ * @Returns: None
+ */
+void free_multi_signature(multi_sign *signature);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef PROOF_CACHE_H
+#define PROOF_CACHE_H
+
+#include "stdint.h"
+
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      Signatures from the same tree share the nodes near the root. Once
+ *      a signature is proven, the interior nodes of its path are known to
+ *      belong to the tree, so the next signature only has to hash up to
+ *      the first of them it meets.
+ */
+
+typedef struct Proof_cache proof_cache;
+
+/*
+ * @Function:
+ *  create_proof_cache
+ *
+ * @Description:
+ *  Creates a cache of proven interior nodes, keyed by the root they lead
+ *  to, their level (leaves are level 0) and their index in that level.
+ *  All the memory is allocated here; when the cache is full the least
+ *  recently used node is evicted.
+ *  The cache isn't thread safe, each verifying thread should own one.
+ *
+ * @Parameters:
+ *  The maximum number of nodes kept.
+ *
+ * @Returns: The cache, or NULL if it couldn't be allocated.
+ */
+proof_cache* create_proof_cache(uint32_t max_nodes);
+
+/*
+ * @Function:
+ *  verify_prove_cached
+ *
+ * @Description:
+ *  Same as verify_prove, but stops climbing the tree at the first node
+ *  already proven for this public hash. The nodes of a successful proof
+ *  are added to the cache. The path entries above a proven node aren't
+ *  read, the leaf is already known to be in the tree.
+ *
+ * @Parameters:
+ *  The cache, public key, the message and the merkle signature.
+ *
+ * @Returns: true or false if the signature matchs or not.
+ */
+uint8_t verify_prove_cached(proof_cache *cache, uint8_t *pub, char *message, merkle_sign *signature);
+
+/*
+ * @Function:
+ *  proof_cache_stats
+ *
+ * @Description:
+ *  Reads the cache counters. Every node looked up is either a hit or a
+ *  miss.
+ *
+ * @Parameters:
+ *  The cache and where to store the hits, misses and evictions (any of
+ *  them may be NULL).
+ *
+ * @Returns: None
+ */
+void proof_cache_stats(proof_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+
+/*
+ * @Function:
+ *  free_proof_cache
+ *
+ * @Description:
+ *  Frees the cache.
+ *
+ * @Parameters:
+ *  The cache.
+ *
+ * @Returns: None
+ */
+void free_proof_cache(proof_cache *cache);
+
+#endif
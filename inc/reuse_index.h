@@ -0,0 +1,118 @@
+#ifndef REUSE_INDEX_H
+#define REUSE_INDEX_H
+
+#include "stdint.h"
+
+#include "signature.h"
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      A Lamport key that signs twice leaks enough of its private key
+ *      for anyone to forge signatures (see signature_attack.h). The
+ *      verifier keeps every leaf hash it has seen in this index, so the
+ *      second use of a key is caught the moment it shows up.
+ */
+
+#define INDEX_ERROR 0
+#define KEY_FIRST_USE 1
+#define KEY_REUSED 2
+
+typedef struct Reuse_index reuse_index;
+
+/*
+ * @Function:
+ *  create_reuse_index
+ *
+ * @Description:
+ *  Creates an open addressing hash table of leaf hashes. When a path is
+ *  given the table lives in that file (mapped in memory), so it can grow
+ *  past the RAM the verifier wants to spend and survives restarts; an
+ *  existing file is opened with the keys it already holds.
+ *
+ * @Parameters:
+ *  The number of keys expected (the table grows when needed) and the
+ *  file to spill to, or NULL to keep the table in memory only.
+ *
+ * @Returns: The index, or NULL if it couldn't be created or the file
+ *  holds a table whose header is broken.
+ */
+reuse_index* create_reuse_index(uint64_t capacity, char *path);
+
+/*
+ * @Function:
+ *  reuse_index_insert
+ *
+ * @Description:
+ *  Records a leaf hash (the data of the node set by node_set_leaf).
+ *
+ * @Parameters:
+ *  The index and the leaf hash (SHA256_DIGEST_LENGTH bytes).
+ *
+ * @Returns:
+ *  KEY_FIRST_USE, KEY_REUSED if the hash was already recorded or
+ *  INDEX_ERROR if the table couldn't grow, and then the hash isn't
+ *  recorded.
+ */
+int reuse_index_insert(reuse_index *index, uint8_t *leaf_hash);
+
+/*
+ * @Function:
+ *  reuse_index_insert_key
+ *
+ * @Description:
+ *  Records a raw Lamport public key, hashed the same way as a leaf.
+ *
+ * @Parameters:
+ *  The index and the public key.
+ *
+ * @Returns: Same as reuse_index_insert.
+ */
+int reuse_index_insert_key(reuse_index *index, key *pub);
+
+/*
+ * @Function:
+ *  verify_prove_unique
+ *
+ * @Description:
+ *  Verifies the merkle signature and records its leaf in the index.
+ *
+ * @Parameters:
+ *  The index, the public hash, the message and the merkle signature.
+ *
+ * @Returns:
+ *  0 if the signature doesn't match, KEY_FIRST_USE if it does, or
+ *  KEY_REUSED if it does but its key already signed something else.
+ */
+int verify_prove_unique(reuse_index *index, uint8_t *pub, char *message, merkle_sign *signature);
+
+/*
+ * @Function:
+ *  reuse_index_count
+ *
+ * @Description:
+ *  Returns how many keys are recorded.
+ *
+ * @Parameters:
+ *  The index.
+ *
+ * @Returns: The number of keys.
+ */
+uint64_t reuse_index_count(reuse_index *index);
+
+/*
+ * @Function:
+ *  free_reuse_index
+ *
+ * @Description:
+ *  Unmaps the table (flushing it to the file, if there's one) and frees
+ *  the index.
+ *
+ * @Parameters:
+ *  The index.
+ *
+ * @Returns: None
+ */
+void free_reuse_index(reuse_index *index);
+
+#endif
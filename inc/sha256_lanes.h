@@ -0,0 +1,52 @@
+#ifndef SHA256_LANES_H
+#define SHA256_LANES_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+/*
+ *  Purpose:
+ *      SHA-256 of many 32 byte blocks at once. Every Lamport block and
+ *      every public key block is 32 bytes, so their hash is always a
+ *      single padded SHA-256 block. The lanes run the same rounds on
+ *      different blocks side by side in vector registers (GCC vector
+ *      extensions, so the compiler picks SSE, AVX or NEON), with no
+ *      branch and no table lookup that depends on the data.
+ */
+
+#define SHA256_LANES 16
+
+/*
+ * @Function:
+ *  sha256_blocks
+ *
+ * @Description:
+ *  Hashes n blocks of 32 bytes, SHA256_LANES at a time. The digests are
+ *  the same as the ones of SHA256 from OpenSSL.
+ *
+ * @Parameters:
+ *  The address of each block, where to store the digests (32 bytes each,
+ *  one after the other) and the number of blocks.
+ *
+ * @Returns: None
+ */
+void sha256_blocks(uint8_t *const *blocks, uint8_t *digests, int n);
+
+/*
+ * @Function:
+ *  sha256_blocks_compare
+ *
+ * @Description:
+ *  Hashes n blocks of 32 bytes like sha256_blocks and compares every
+ *  digest with the expected one. All of them are compared, there's no
+ *  early exit.
+ *
+ * @Parameters:
+ *  The address of each block, the address of each expected digest and
+ *  the number of blocks.
+ *
+ * @Returns: 0 if every digest matches, the differences OR'ed otherwise.
+ */
+uint32_t sha256_blocks_compare(uint8_t *const *blocks, uint8_t *const *expected, int n);
+
+#endif
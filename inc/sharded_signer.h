@@ -0,0 +1,81 @@
+#ifndef SHARDED_SIGNER_H
+#define SHARDED_SIGNER_H
+
+#include "stdint.h"
+
+#include "merkle_tree.h"
+
+/*
+ *  Purpose:
+ *      A single tree hands out its keys one at a time. The sharded signer
+ *      owns one independent tree per shard and publishes their roots as
+ *      the leaves of a small top tree, so each thread can sign from its
+ *      own shard without any lock. The signatures are ordinary merkle
+ *      signatures whose path continues through the top tree, so they are
+ *      checked with verify_prove against the sharded public hash.
+ */
+
+typedef struct Sharded_signer sharded_signer;
+
+/*
+ * @Function:
+ *  build_sharded_signer
+ *
+ * @Description:
+ *  Builds the shard trees (one thread per shard) and the top tree over
+ *  their roots.
+ *
+ * @Parameters:
+ *  The number of shards and the number of messages each shard can sign
+ *  (both must be a power of two, the program exits otherwise).
+ *
+ * @Returns: The signer.
+ */
+sharded_signer* build_sharded_signer(uint16_t n_shards, uint16_t n_messages);
+
+/*
+ * @Function:
+ *  sharded_signature
+ *
+ * @Description:
+ *  Claims the next key of the shard with an atomic counter and signs the
+ *  message. When the shard is exhausted the following shards are tried.
+ *  Safe to call from any number of threads.
+ *
+ * @Parameters:
+ *  The signer, the preferred shard (usually the thread or core number)
+ *  and the message to sign.
+ *
+ * @Returns: The merkle signature or NULL if every shard is exhausted.
+ */
+merkle_sign* sharded_signature(sharded_signer *signer, uint16_t shard, char *message);
+
+/*
+ * @Function:
+ *  get_sharded_public_hash
+ *
+ * @Description:
+ *  Returns the public hash, the root of the top tree.
+ *
+ * @Parameters:
+ *  The signer.
+ *
+ * @Returns: The hash.
+ */
+uint8_t* get_sharded_public_hash(sharded_signer *signer);
+
+/*
+ * @Function:
+ *  free_sharded_signer
+ *
+ * @Description:
+ *  Frees every shard tree and the top tree.
+ *
+ * @Parameters:
+ *  The signer.
+ *
+ * @Returns: None
+ */
+void free_sharded_signer(sharded_signer *signer);
+
+#endif
@@ -25,6 +25,39 @@ typedef struct Key {
  */
 void GenerateKeys(key* prv, key* pub);
 
+/*
+ * @Function:
+ *  GenerateKeysFromSeed
+ *
+ * @Description:
+ *  Same as GenerateKeys, but every block of the private key is derived
+ *  from the seed with derive_seed, so the same seed always gives the
+ *  same key pair.
+ *
+ * @Parameters:
+ *  The private key and public key to store the keys generated, and the
+ *  seed (SHA256_DIGEST_LENGTH bytes).
+ *
+ * @Return: None.
+ */
+void GenerateKeysFromSeed(key* prv, key* pub, uint8_t *seed);
+
+/*
+ * @Function:
+ *  derive_seed
+ *
+ * @Description:
+ *  Derives a new seed as the sha256 hash of the seed and the index, so
+ *  one secret seed gives any number of unrelated ones.
+ *
+ * @Parameters:
+ *  The seed, the index and where to store the new seed (both
+ *  SHA256_DIGEST_LENGTH bytes).
+ *
+ * @Return: None.
+ */
+void derive_seed(uint8_t *seed, uint32_t index, uint8_t *out);
+
 /*
  * @Function:
  *  Sign
@@ -63,7 +96,9 @@ int check_hash(uint8_t *block, uint8_t *hash, int n);
  *
  * @Description:
  *  Check if the part's of the private key match the public key according
- *  with the message.
+ *  with the message. Every block is hashed (see sha256_lanes.h) and
+ *  compared whatever the result, so the time doesn't depend on which
+ *  block is wrong, or on the bits of the message.
  *
  * @Parameters:
  *  The public key, the message and the sign.
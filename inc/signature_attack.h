@@ -9,6 +9,19 @@
  *      private key to sign multiples messages.
  */
 
+#define NOUNCE_DECIMAL 0
+#define NOUNCE_BINARY 1
+#define N_ENCODINGS 2
+
+#define COVER_ZERO 1
+#define COVER_ONE 2
+
+#define FORGED_MESSAGE_SIZE 100
+// Longest message that still leaves room for " + ", the widest nounce
+// (20 decimal digits) and the '\0'
+#define MAX_ATTACK_MESSAGE (FORGED_MESSAGE_SIZE - 3 - 20 - 1)
+#define ATTACK_ABORTED 18446744073709551615ULL
+
 typedef struct Signatures {
   uint8_t n;
   uint8_t **sign;
@@ -20,24 +33,84 @@ typedef struct Attack {
   signatures *signs;
   char *message;
   uint8_t *forge;
+  char **templates;
+  int n_templates;
+  double max_seconds;
+  int encoding;
+  unsigned long long int max_attempts;
+  unsigned long long int attempts;
+  double seconds;
+  int affinity;
 } attackArgs;
 
+typedef struct Estimate {
+  int template;
+  int encoding;
+  int blocked;
+  int free_bits;
+  double attempts;
+  double hash_rate;
+  double seconds;
+} estimate;
+
 /*
  * @Function:
  *  copy_signature
  *
  * @Description:
- *  It copy's the signatures used in each message.
+ *  It copy's the signatures used in each message and marks in the
+ *  coverage mask which blocks (COVER_ZERO, COVER_ONE) are now known.
  *
  * @Parameters:
  *  The public key to check what part of the private key it belongs.
  *  The signatures itself.
  *  The false private key that'll be copying the specific block of
  *  the signature
+ *  The coverage mask, one entry per bit of the message hash.
  *
  * @Return: None
  */
-void copy_signature(key* pub, signatures *clues, key *false_key);
+void copy_signature(key* pub, signatures *clues, key *false_key, uint8_t *mask);
+
+/*
+ * @Function:
+ *  format_nounce
+ *
+ * @Description:
+ *  Writes the message followed by the nounce with the chosen encoding.
+ *  NOUNCE_DECIMAL appends " + <decimal>", NOUNCE_BINARY appends " + "
+ *  and ten bytes carrying seven bits of the nounce each (high bit set
+ *  so the message stays a C string).
+ *
+ * @Parameters:
+ *  The output buffer (FORGED_MESSAGE_SIZE bytes), the message, the
+ *  nounce and the encoding.
+ *
+ * @Return: The length of the message written, or -1 if the message and
+ *  the nounce don't fit (the buffer then holds the empty string).
+ */
+int format_nounce(char *out, char *message, unsigned long long int nounce, int encoding);
+
+/*
+ * @Function:
+ *  estimate_forgery
+ *
+ * @Description:
+ *  Reads the coverage mask and computes how many nounces are expected
+ *  to be tried before a forgery is found. The hash rate of every
+ *  candidate template and nounce encoding is measured and the pair with
+ *  the smallest projected time is chosen. Templates longer than
+ *  MAX_ATTACK_MESSAGE are skipped. When some bit has no block revealed
+ *  nothing is measured: blocked is set, the time is infinite and the
+ *  first template that fits is kept.
+ *
+ * @Parameters:
+ *  The attack arguments (templates, number of threads), the coverage
+ *  mask and the estimate to fill.
+ *
+ * @Return: 1, or 0 if no template fits.
+ */
+int estimate_forgery(attackArgs *values, uint8_t *mask, estimate *cost);
 
 /*
  * @Function:
@@ -60,12 +133,22 @@ void *forge_signature(void *args);
  *
  * @Description:
  *  It call's the functions in the right order and deals with parallelism.
+ *  The search only starts if the projected time fits in max_seconds
+ *  (zero means no limit). When templates are given the cheapest one
+ *  replaces the message, and the chosen encoding is stored in the
+ *  arguments so the forged message can be rebuilt with format_nounce.
+ *  Each thread gives up after max_attempts nounces (zero means no
+ *  limit); the nounces tried and the seconds the search took are stored
+ *  in attempts and seconds. The threads come from a thread pool pinned
+ *  with the affinity policy (POOL_*), each reading a copy of the table
+ *  of copied blocks local to its NUMA node. Messages longer than
+ *  MAX_ATTACK_MESSAGE are refused.
  *
  * @Parameters:
  *  The public key, the signatures of the messages, the message to forge the
  *  signature and the pointer of bytes to store the signature forged.
  *
- * @Return: None.
+ * @Return: The nounce found, or ATTACK_ABORTED.
  */
 unsigned long long int attack_lamport(attackArgs *values);
 
@@ -0,0 +1,38 @@
+#ifndef SIGNER_PROTOCOL_H
+#define SIGNER_PROTOCOL_H
+
+/*
+ *  Purpose:
+ *      Wire format of the signing daemon (tools/signerd.c). One process
+ *      owns the hypertree and every application asks it for signatures
+ *      over a Unix socket, so no one time key can be handed out twice.
+ *      Integers are in the byte order of the machine, the socket is local.
+ *
+ *  Request:
+ *      |operation (1 byte)|id (4 bytes)|payload size (4 bytes)|payload|
+ *
+ *      SIGNER_SIGN        the message, without the ending '\0'
+ *      SIGNER_VERIFY      |message size (4 bytes)|message|hypertree signature|
+ *      SIGNER_PUBLIC_KEY  nothing
+ *
+ *  Response:
+ *      |status (1 byte)|id (4 bytes)|payload size (4 bytes)|payload|
+ *
+ *      The id is the one of the request. A signature comes back as the
+ *      bytes of get_hyper_sign_bytes, the public key as its 32 bytes and a
+ *      verification only has a status. Requests of one connection are
+ *      answered in order.
+ */
+
+#define SIGNER_SIGN 1
+#define SIGNER_VERIFY 2
+#define SIGNER_PUBLIC_KEY 3
+
+#define SIGNER_OK 0
+#define SIGNER_INVALID 1
+#define SIGNER_ERROR 2
+
+#define SIGNER_HEADER_SIZE 9
+#define SIGNER_MAX_PAYLOAD (1 << 20)
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "stdint.h"
+
+/*
+ *  Purpose:
+ *      Counters and latency histograms for the hot paths. Every thread
+ *      writes to its own copy, so recording is a couple of additions
+ *      without locks or atomics; the copies are only summed when the
+ *      statistics are dumped.
+ *
+ *      Built with -DLAMPORT_STATS (make stats). Otherwise every STATS_
+ *      macro expands to nothing and none of this is compiled.
+ */
+
+#define STAT_SHA256_BLOCKS 0
+#define STAT_BYTES_HASHED 1
+#define STAT_SIGNATURES_ISSUED 2
+#define STAT_SIGNATURES_VERIFIED 3
+#define STAT_SIGNATURES_REJECTED 4
+#define STAT_LEAVES_REMAINING 5
+#define N_STATS 6
+
+#define TIMER_GENERATE_KEYS 0
+#define TIMER_SIGN 1
+#define TIMER_VERIFY 2
+#define TIMER_BUILD_TREE 3
+#define TIMER_MERKLE_SIGNATURE 4
+#define TIMER_VERIFY_PROVE 5
+#define N_TIMERS 6
+
+#define STATS_TEXT 0
+#define STATS_JSON 1
+
+#ifdef LAMPORT_STATS
+
+#define STATS_ADD(stat, n) stats_add(stat, n)
+#define STATS_HASH(bytes) stats_hash(bytes)
+#define STATS_START(name) uint64_t stats_start_##name = stats_now()
+#define STATS_STOP(timer, name) stats_record(timer, stats_now() - stats_start_##name)
+#define STATS_DUMP(out, format) stats_dump(out, format)
+#define STATS_REPORT(out, format, interval_ms) stats_start_reporter(out, format, interval_ms)
+#define STATS_REPORT_STOP() stats_stop_reporter()
+
+/*
+ * @Function:
+ *  stats_add
+ *
+ * @Description:
+ *  Adds to one of the counters of the calling thread. Leaves remaining
+ *  goes up when a tree is built and down when a key is used.
+ *
+ * @Parameters:
+ *  The counter (STAT_*) and how much to add.
+ *
+ * @Returns: None
+ */
+void stats_add(int stat, int64_t n);
+
+/*
+ * @Function:
+ *  stats_hash
+ *
+ * @Description:
+ *  Counts one SHA-256 of the given size: the bytes and the 64 byte blocks
+ *  compressed, padding included.
+ *
+ * @Parameters:
+ *  The number of bytes hashed.
+ *
+ * @Returns: None
+ */
+void stats_hash(uint64_t bytes);
+
+/*
+ * @Function:
+ *  stats_now
+ *
+ * @Description:
+ *  Reads the monotonic clock.
+ *
+ * @Parameters:
+ *  None.
+ *
+ * @Returns: The time in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+/*
+ * @Function:
+ *  stats_record
+ *
+ * @Description:
+ *  Adds a latency to the histogram of the calling thread. Buckets are
+ *  split in 8 per power of two, so the error is under 12.5%.
+ *
+ * @Parameters:
+ *  The timer (TIMER_*) and the latency in nanoseconds.
+ *
+ * @Returns: None
+ */
+void stats_record(int timer, uint64_t nanoseconds);
+
+/*
+ * @Function:
+ *  stats_dump
+ *
+ * @Description:
+ *  Sums the counters and histograms of every thread and writes them with
+ *  count, mean, p50, p90, p99, p99.9 and max of every timer.
+ *
+ * @Parameters:
+ *  Where to write and the format (STATS_TEXT or STATS_JSON).
+ *
+ * @Returns: None
+ */
+void stats_dump(FILE *out, int format);
+
+/*
+ * @Function:
+ *  stats_start_reporter
+ *
+ * @Description:
+ *  Starts a thread that calls stats_dump periodically.
+ *
+ * @Parameters:
+ *  Where to write, the format and the interval in milliseconds.
+ *
+ * @Returns: None
+ */
+void stats_start_reporter(FILE *out, int format, unsigned int interval_ms);
+
+/*
+ * @Function:
+ *  stats_stop_reporter
+ *
+ * @Description:
+ *  Stops the reporter thread.
+ *
+ * @Parameters:
+ *  None.
+ *
+ * @Returns: None
+ */
+void stats_stop_reporter(void);
+
+#else
+
+#define STATS_ADD(stat, n) ((void) 0)
+#define STATS_HASH(bytes) ((void) 0)
+#define STATS_START(name) ((void) 0)
+#define STATS_STOP(timer, name) ((void) 0)
+#define STATS_DUMP(out, format) ((void) 0)
+#define STATS_REPORT(out, format, interval_ms) ((void) 0)
+#define STATS_REPORT_STOP() ((void) 0)
+
+#endif
+
+#endif
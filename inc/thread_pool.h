@@ -0,0 +1,201 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include "stdint.h"
+
+/*
+ *  Purpose:
+ *      Threads that stay where they were put. The pool reads the NUMA
+ *      nodes from /sys/devices/system/node (one node with every CPU when
+ *      it isn't there) and pins each thread with a policy:
+ *
+ *      POOL_COMPACT  one CPU each, filling a node before the next one, so
+ *                    few threads share the caches of one socket.
+ *      POOL_SCATTER  one CPU each, taking nodes in turn, so every socket
+ *                    and its memory bandwidth is used.
+ *      POOL_NODE     threads go to the nodes in turn and may run on any
+ *                    CPU of their node.
+ *      POOL_UNPINNED the scheduler decides, every thread counts as node 0.
+ *
+ *      Data that every thread reads can be replicated, one copy per node
+ *      written by a thread of that node, so the pages live in its local
+ *      memory and the cache lines never cross sockets.
+ */
+
+#define POOL_UNPINNED 0
+#define POOL_COMPACT 1
+#define POOL_SCATTER 2
+#define POOL_NODE 3
+
+#define POOL_MAX_NODES 64
+
+typedef struct Thread_pool thread_pool;
+typedef struct Replica replica_t;
+
+/*
+ * The work given to every thread of the pool: the shared arguments, the
+ * index of the thread (0 to size - 1) and the node it runs on.
+ */
+typedef void (*pool_task)(void *args, int thread, int node);
+
+/*
+ * @Function:
+ *  create_thread_pool
+ *
+ * @Description:
+ *  Starts the threads and pins them. They sleep until there's a task.
+ *
+ * @Parameters:
+ *  The number of threads and the policy (POOL_*).
+ *
+ * @Returns: The pool, or NULL if the threads couldn't be started.
+ */
+thread_pool* create_thread_pool(int n_threads, int policy);
+
+/*
+ * @Function:
+ *  thread_pool_policy
+ *
+ * @Description:
+ *  Parses the name of a policy: none, compact, scatter or node.
+ *
+ * @Parameters:
+ *  The name.
+ *
+ * @Returns: The policy, or -1 if the name is unknown.
+ */
+int thread_pool_policy(char *name);
+
+/*
+ * @Function:
+ *  thread_pool_start
+ *
+ * @Description:
+ *  Runs the task once on every thread of the pool and returns at once.
+ *  Only one task runs at a time, a second start waits for the first one
+ *  to be waited for.
+ *
+ * @Parameters:
+ *  The pool, the task and its arguments.
+ *
+ * @Returns: None
+ */
+void thread_pool_start(thread_pool *pool, pool_task task, void *args);
+
+/*
+ * @Function:
+ *  thread_pool_wait
+ *
+ * @Description:
+ *  Waits until every thread finished the task given to thread_pool_start.
+ *
+ * @Parameters:
+ *  The pool.
+ *
+ * @Returns: None
+ */
+void thread_pool_wait(thread_pool *pool);
+
+/*
+ * @Function:
+ *  thread_pool_run
+ *
+ * @Description:
+ *  thread_pool_start followed by thread_pool_wait.
+ *
+ * @Parameters:
+ *  The pool, the task and its arguments.
+ *
+ * @Returns: None
+ */
+void thread_pool_run(thread_pool *pool, pool_task task, void *args);
+
+/*
+ * @Function:
+ *  thread_pool_size
+ *
+ * @Description:
+ *  Returns the number of threads.
+ *
+ * @Parameters:
+ *  The pool.
+ *
+ * @Returns: The number of threads.
+ */
+int thread_pool_size(thread_pool *pool);
+
+/*
+ * @Function:
+ *  thread_pool_nodes
+ *
+ * @Description:
+ *  Returns the number of nodes, the valid nodes given to tasks and
+ *  get_replica go from 0 to this minus one.
+ *
+ * @Parameters:
+ *  The pool.
+ *
+ * @Returns: The number of nodes.
+ */
+int thread_pool_nodes(thread_pool *pool);
+
+/*
+ * @Function:
+ *  free_thread_pool
+ *
+ * @Description:
+ *  Stops and joins the threads. No task may be running.
+ *
+ * @Parameters:
+ *  The pool.
+ *
+ * @Returns: None
+ */
+void free_thread_pool(thread_pool *pool);
+
+/*
+ * @Function:
+ *  create_replica
+ *
+ * @Description:
+ *  Copies read only data once per node that has threads in the pool,
+ *  each copy allocated and written by a thread of its node. Nodes
+ *  without threads share the first copy.
+ *
+ * @Parameters:
+ *  The pool, the data and its size.
+ *
+ * @Returns: The replica, or NULL if the memory couldn't be allocated.
+ */
+replica_t* create_replica(thread_pool *pool, void *data, size_t size);
+
+/*
+ * @Function:
+ *  get_replica
+ *
+ * @Description:
+ *  Returns the copy of a node.
+ *
+ * @Parameters:
+ *  The replica and the node given to the task.
+ *
+ * @Returns: The copy.
+ */
+void* get_replica(replica_t *replica, int node);
+
+/*
+ * @Function:
+ *  free_replica
+ *
+ * @Description:
+ *  Frees every copy.
+ *
+ * @Parameters:
+ *  The replica.
+ *
+ * @Returns: None
+ */
+void free_replica(replica_t *replica);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "allocator.h"
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct Chunk chunk_t;
+
+struct Chunk {
+  void *pages;
+  size_t size;
+  chunk_t *next;
+};
+
+struct Arena {
+  chunk_t *chunks;
+  uint8_t *position;
+  size_t left;
+  size_t chunk_size;
+  int flags;
+};
+
+struct Slab {
+  chunk_t *chunks;
+  void *free_objects;
+  uint8_t *position;
+  uint32_t left;
+  uint32_t per_chunk;
+  size_t object_size;
+  int flags;
+};
+
+static size_t round_size(size_t size, int flags) {
+
+  size_t page = (flags & ALLOC_HUGE_PAGES) ? HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+
+  return (size + page - 1) / page * page;
+}
+
+void* alloc_pages(size_t size, int flags) {
+
+  void *pages = MAP_FAILED;
+  size = round_size(size, flags);
+
+#ifdef MAP_HUGETLB
+  if(flags & ALLOC_HUGE_PAGES) {
+    pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+
+  if(pages == MAP_FAILED) {
+    pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pages == MAP_FAILED) {
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if(flags & ALLOC_HUGE_PAGES) {
+      madvise(pages, size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+  // Best effort, the memlock limit may be too low for the whole mapping
+  if(flags & ALLOC_LOCKED) {
+    mlock(pages, size);
+  }
+
+  return pages;
+}
+
+void free_pages(void *pages, size_t size, int flags) {
+  munmap(pages, round_size(size, flags));
+}
+
+static chunk_t* add_chunk(chunk_t **chunks, size_t size, int flags) {
+
+  chunk_t *chunk = malloc(sizeof(chunk_t));
+  if(chunk == NULL) {
+    return NULL;
+  }
+
+  chunk->pages = alloc_pages(size, flags);
+  if(chunk->pages == NULL) {
+    free(chunk);
+    return NULL;
+  }
+
+  chunk->size = size;
+  chunk->next = *chunks;
+  *chunks = chunk;
+
+  return chunk;
+}
+
+static void free_chunks(chunk_t *chunks, int flags) {
+
+  chunk_t *next;
+  while(chunks != NULL) {
+    next = chunks->next;
+    free_pages(chunks->pages, chunks->size, flags);
+    free(chunks);
+    chunks = next;
+  }
+}
+
+arena_t* create_arena(size_t chunk_size, int flags) {
+
+  arena_t *arena = malloc(sizeof(arena_t));
+  if(arena == NULL) {
+    return NULL;
+  }
+
+  arena->chunks = NULL;
+  arena->position = NULL;
+  arena->left = 0;
+  arena->chunk_size = round_size(chunk_size, flags);
+  arena->flags = flags;
+
+  return arena;
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+
+  size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+  if(size > arena->left) {
+    size_t chunk_size = size > arena->chunk_size ? round_size(size, arena->flags) : arena->chunk_size;
+    chunk_t *chunk = add_chunk(&arena->chunks, chunk_size, arena->flags);
+    if(chunk == NULL) {
+      return NULL;
+    }
+    arena->position = chunk->pages;
+    arena->left = chunk_size;
+  }
+
+  void *memory = arena->position;
+  arena->position += size;
+  arena->left -= size;
+
+  return memory;
+}
+
+size_t arena_mapped(arena_t *arena) {
+
+  size_t size = 0;
+  for(chunk_t *chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+    size += round_size(chunk->size, arena->flags);
+  }
+
+  return size;
+}
+
+void free_arena(arena_t *arena) {
+
+  free_chunks(arena->chunks, arena->flags);
+  free(arena);
+  arena = NULL;
+}
+
+slab_t* create_slab(size_t object_size, uint32_t per_chunk, int flags) {
+
+  if(object_size < sizeof(void *) || per_chunk == 0) {
+    return NULL;
+  }
+
+  slab_t *slab = malloc(sizeof(slab_t));
+  if(slab == NULL) {
+    return NULL;
+  }
+
+  slab->chunks = NULL;
+  slab->free_objects = NULL;
+  slab->position = NULL;
+  slab->left = 0;
+  slab->per_chunk = per_chunk;
+  slab->object_size = object_size;
+  slab->flags = flags;
+
+  return slab;
+}
+
+void* slab_alloc(slab_t *slab) {
+
+  // Freed objects keep the pointer to the next freed one
+  if(slab->free_objects != NULL) {
+    void *object = slab->free_objects;
+    memcpy(&slab->free_objects, object, sizeof(void *));
+    return object;
+  }
+
+  if(slab->left == 0) {
+    chunk_t *chunk = add_chunk(&slab->chunks, slab->object_size*slab->per_chunk, slab->flags);
+    if(chunk == NULL) {
+      return NULL;
+    }
+    slab->position = chunk->pages;
+    slab->left = slab->per_chunk;
+  }
+
+  void *object = slab->position;
+  slab->position += slab->object_size;
+  slab->left--;
+
+  return object;
+}
+
+void slab_free(slab_t *slab, void *object) {
+
+  memcpy(object, &slab->free_objects, sizeof(void *));
+  slab->free_objects = object;
+}
+
+int slab_discard(slab_t *slab, void *object) {
+
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+  explicit_bzero(object, slab->object_size);
+
+  if((uintptr_t) object % page || slab->object_size % page) {
+    return 0;
+  }
+
+  // Locked pages can't be dropped
+  if(slab->flags & ALLOC_LOCKED) {
+    munlock(object, slab->object_size);
+  }
+
+  return !madvise(object, slab->object_size, MADV_DONTNEED);
+}
+
+void free_slab(slab_t *slab) {
+
+  free_chunks(slab->chunks, slab->flags);
+  free(slab);
+  slab = NULL;
+}
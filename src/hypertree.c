@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "merkle_tree_internal.h"
+#include "hypertree.h"
+#include "key_pipeline.h"
+#include "stats.h"
+
+#define ROOT_MESSAGE_SIZE (2*SHA256_DIGEST_LENGTH + 1)
+
+struct Hypertree {
+  uint8_t layers;
+  uint16_t n_messages;
+  tree_t *trees[MAX_LAYERS];
+  merkle_sign *roots[MAX_LAYERS];
+  uint16_t used[MAX_LAYERS];
+  key_pipeline *pipelines[MAX_LAYERS];
+  uint16_t lookahead;
+  uint8_t seed[SHA256_DIGEST_LENGTH];
+  int seeded;
+  uint32_t built[MAX_LAYERS];
+};
+
+struct Hyper_sign {
+  uint8_t *sign;
+  uint32_t size;
+};
+
+static merkle_sign* sign_layer(hypertree *tree, int layer, char *message);
+
+/*
+ * Sign takes a C string, so the roots are signed in hexadecimal.
+ */
+static void root_message(uint8_t *root, char *message) {
+
+  for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+    sprintf(message + 2*i, "%02x", root[i]);
+  }
+}
+
+/*
+ * Tree i of a layer comes from the seed of the layer derived with index
+ * i, so a hypertree built again from its seed has the same trees in the
+ * same order.
+ */
+static void layer_seed(hypertree *tree, int layer, uint8_t *seed) {
+  derive_seed(tree->seed, layer, seed);
+}
+
+static tree_t* build_layer_tree(hypertree *tree, int layer) {
+
+  if(!tree->seeded) {
+    return build_tree(tree->n_messages);
+  }
+
+  uint8_t seed[SHA256_DIGEST_LENGTH];
+  layer_seed(tree, layer, seed);
+  derive_seed(seed, tree->built[layer], seed);
+  tree_t *next = build_tree_seeded(tree->n_messages, seed);
+  explicit_bzero(seed, sizeof(seed));
+
+  return next;
+}
+
+/*
+ * Replaces the tree of a layer by a new one, signed by the layer above.
+ * The top tree is the public key, it's never replaced.
+ */
+static int next_tree(hypertree *tree, int layer) {
+
+  if(layer == tree->layers - 1) {
+    return 0;
+  }
+
+  tree_t *next;
+  if(tree->pipelines[layer] != NULL) {
+    next = key_pipeline_take(tree->pipelines[layer]);
+  } else {
+    next = build_layer_tree(tree, layer);
+  }
+  tree->built[layer]++;
+
+  char message[ROOT_MESSAGE_SIZE];
+  root_message(get_public_hash(next), message);
+
+  merkle_sign *root = sign_layer(tree, layer + 1, message);
+  if(root == NULL) {
+    free_tree(next);
+    return 0;
+  }
+
+  if(tree->trees[layer] != NULL) {
+    free_tree(tree->trees[layer]);
+    free_merkle_signature(tree->roots[layer]);
+  }
+  set_tree_lookahead(next, tree->lookahead);
+  tree->trees[layer] = next;
+  tree->roots[layer] = root;
+  tree->used[layer] = 0;
+
+  return 1;
+}
+
+static merkle_sign* sign_layer(hypertree *tree, int layer, char *message) {
+
+  merkle_sign *signature = NULL;
+
+  if(tree->trees[layer] != NULL) {
+    signature = merkle_signature(tree->trees[layer], message);
+  }
+
+  if(signature == NULL && next_tree(tree, layer)) {
+    signature = merkle_signature(tree->trees[layer], message);
+  }
+
+  if(signature != NULL) {
+    tree->used[layer]++;
+    if(tree->pipelines[layer] != NULL) {
+      key_pipeline_report(tree->pipelines[layer], tree->n_messages - tree->used[layer]);
+    }
+  }
+
+  return signature;
+}
+
+hypertree* build_hypertree(uint8_t layers, uint16_t n_messages) {
+  return build_hypertree_seeded(layers, n_messages, NULL);
+}
+
+hypertree* build_hypertree_seeded(uint8_t layers, uint16_t n_messages, uint8_t *seed) {
+
+  if(layers == 0 || layers > MAX_LAYERS) {
+    return NULL;
+  }
+
+  hypertree *tree = malloc(sizeof(hypertree));
+
+  if(tree == NULL) {
+    printf("Can't allocate memory for the hypertree\n");
+    exit(EXIT_FAILURE);
+  }
+
+  tree->layers = layers;
+  tree->n_messages = n_messages;
+  tree->lookahead = 0;
+  for(int i = 0; i < MAX_LAYERS; ++i) {
+    tree->trees[i] = NULL;
+    tree->roots[i] = NULL;
+    tree->used[i] = 0;
+    tree->pipelines[i] = NULL;
+    tree->built[i] = 0;
+  }
+
+  tree->seeded = seed != NULL;
+  if(tree->seeded) {
+    memcpy(tree->seed, seed, SHA256_DIGEST_LENGTH);
+  }
+
+  tree->trees[layers - 1] = build_layer_tree(tree, layers - 1);
+  tree->built[layers - 1]++;
+
+  return tree;
+}
+
+hyper_sign* hypertree_signature(hypertree *tree, char *message) {
+
+  merkle_sign *bottom = sign_layer(tree, 0, message);
+  if(bottom == NULL) {
+    return NULL;
+  }
+
+  // The bottom signature, then the signature of each root up to the top
+  merkle_sign *layers[MAX_LAYERS];
+  layers[0] = bottom;
+  for(int i = 1; i < tree->layers; ++i) {
+    layers[i] = tree->roots[i - 1];
+  }
+
+  hyper_sign *signature = malloc(sizeof(hyper_sign));
+  signature->size = 1;
+  for(int i = 0; i < tree->layers; ++i) {
+    signature->size += sizeof(uint16_t) + layers[i]->size;
+  }
+  signature->sign = malloc(signature->size);
+
+  uint8_t *position = signature->sign;
+  *position++ = tree->layers;
+  for(int i = 0; i < tree->layers; ++i) {
+    memcpy(position, &layers[i]->size, sizeof(uint16_t));
+    memcpy(position + sizeof(uint16_t), layers[i]->sign, layers[i]->size);
+    position += sizeof(uint16_t) + layers[i]->size;
+  }
+
+  free_merkle_signature(bottom);
+
+  return signature;
+}
+
+uint8_t verify_hyper_prove(uint8_t *pub, char *message, hyper_sign *signature) {
+  return verify_hyper_prove_bytes(pub, message, signature->sign, signature->size);
+}
+
+uint8_t verify_hyper_prove_bytes(uint8_t *pub, char *message, uint8_t *bytes, uint32_t size) {
+
+  if(size < 1 || bytes[0] == 0 || bytes[0] > MAX_LAYERS) {
+    return 0;
+  }
+
+  uint8_t root[SHA256_DIGEST_LENGTH];
+  char root_text[ROOT_MESSAGE_SIZE];
+  char *layer_message = message;
+
+  uint8_t *position = bytes + 1;
+  uint8_t *end = bytes + size;
+
+  for(int i = 0; i < bytes[0]; ++i) {
+    merkle_sign layer;
+
+    if(end - position < (long) sizeof(uint16_t)) {
+      return 0;
+    }
+    memcpy(&layer.size, position, sizeof(uint16_t));
+    position += sizeof(uint16_t);
+    layer.sign = position;
+
+    if(layer.size < PATH_OFFSET || end - position < layer.size ||
+        !prove_root(layer_message, &layer, NULL, root)) {
+      return 0;
+    }
+    position += layer.size;
+
+    root_message(root, root_text);
+    layer_message = root_text;
+  }
+
+  if(position != end || memcmp(root, pub, SHA256_DIGEST_LENGTH)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+uint8_t* get_hyper_sign_bytes(hyper_sign *signature, uint32_t *size) {
+
+  *size = signature->size;
+
+  return signature->sign;
+}
+
+int get_hyper_sign_leaves(hyper_sign *signature, uint8_t *leaf_hashes, uint8_t *sign_hashes) {
+
+  uint8_t *position = signature->sign + 1;
+  uint8_t *end = signature->sign + signature->size;
+
+  if(signature->size < 1 || signature->sign[0] == 0 || signature->sign[0] > MAX_LAYERS) {
+    return 0;
+  }
+
+  // The bottom layer comes first
+  for(int i = 0; i < signature->sign[0]; ++i) {
+    uint16_t size;
+    if(end - position < (long) sizeof(uint16_t)) {
+      return 0;
+    }
+    memcpy(&size, position, sizeof(uint16_t));
+    position += sizeof(uint16_t);
+    if(size < PATH_OFFSET || end - position < size) {
+      return 0;
+    }
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, position + BlockByteSize*256, sizeof(key));
+    SHA256_Final(leaf_hashes + i*SHA256_DIGEST_LENGTH, &ctx);
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, position, BlockByteSize*256);
+    SHA256_Final(sign_hashes + i*SHA256_DIGEST_LENGTH, &ctx);
+    STATS_HASH(sizeof(key));
+    STATS_HASH(BlockByteSize*256);
+
+    position += size;
+  }
+
+  return signature->sign[0];
+}
+
+int hypertree_use_pipeline(hypertree *tree, uint16_t low_water, uint8_t high_water) {
+
+  for(int i = 0; i < tree->layers - 1; ++i) {
+    if(tree->pipelines[i] == NULL) {
+      if(tree->seeded) {
+        uint8_t seed[SHA256_DIGEST_LENGTH];
+        layer_seed(tree, i, seed);
+        tree->pipelines[i] = create_key_pipeline_seeded(tree->n_messages, low_water, high_water, seed,
+            tree->built[i]);
+        explicit_bzero(seed, sizeof(seed));
+      } else {
+        tree->pipelines[i] = create_key_pipeline(tree->n_messages, low_water, high_water);
+      }
+      if(tree->pipelines[i] == NULL) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+void hypertree_set_lookahead(hypertree *tree, uint16_t depth) {
+
+  tree->lookahead = depth;
+  for(int i = 0; i < tree->layers; ++i) {
+    if(tree->trees[i] != NULL) {
+      set_tree_lookahead(tree->trees[i], depth);
+    }
+  }
+}
+
+int hypertree_precompute(hypertree *tree, int max) {
+
+  int n = 0;
+
+  // The bottom tree signs every message, the others once per tree below
+  for(int i = 0; i < tree->layers && (max <= 0 || n < max); ++i) {
+    if(tree->trees[i] != NULL) {
+      n += precompute_signatures(tree->trees[i], max <= 0 ? 0 : max - n);
+    }
+  }
+
+  return n;
+}
+
+uint8_t* get_hypertree_public_hash(hypertree *tree) {
+  return get_public_hash(tree->trees[tree->layers - 1]);
+}
+
+void free_hyper_signature(hyper_sign *signature) {
+
+  free(signature->sign);
+  free(signature);
+  signature = NULL;
+}
+
+void free_hypertree(hypertree *tree) {
+
+  for(int i = 0; i < tree->layers; ++i) {
+    if(tree->pipelines[i] != NULL) {
+      free_key_pipeline(tree->pipelines[i]);
+    }
+    if(tree->trees[i] != NULL) {
+      free_tree(tree->trees[i]);
+    }
+    if(tree->roots[i] != NULL) {
+      free_merkle_signature(tree->roots[i]);
+    }
+  }
+  explicit_bzero(tree->seed, sizeof(tree->seed));
+  free(tree);
+  tree = NULL;
+}
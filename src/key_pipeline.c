@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "key_pipeline.h"
+
+struct Key_pipeline {
+  uint16_t n_messages;
+  uint16_t low_water;
+  uint8_t high_water;
+  uint8_t seed[SHA256_DIGEST_LENGTH];
+  int seeded;
+  uint32_t next;
+  tree_t **ready;
+  uint8_t n_ready;
+  uint32_t remaining;
+  int stop;
+  uint64_t built;
+  uint64_t stalls;
+  pthread_mutex_t lock;
+  pthread_cond_t wanted;
+  pthread_cond_t available;
+  pthread_t builder;
+};
+
+static int needs_tree(key_pipeline *pipeline) {
+
+  if(pipeline->n_ready == 0) {
+    return 1;
+  }
+
+  return pipeline->n_ready < pipeline->high_water && pipeline->remaining <= pipeline->low_water;
+}
+
+static void *build_trees(void *args) {
+
+  key_pipeline *pipeline = (key_pipeline *) args;
+
+  pthread_mutex_lock(&pipeline->lock);
+  while(!pipeline->stop) {
+    if(!needs_tree(pipeline)) {
+      pthread_cond_wait(&pipeline->wanted, &pipeline->lock);
+      continue;
+    }
+
+    // The keys are generated without holding the lock. Trees are handed
+    // over in the order they're built, so tree i always comes from seed i
+    uint8_t seed[SHA256_DIGEST_LENGTH];
+    if(pipeline->seeded) {
+      derive_seed(pipeline->seed, pipeline->next++, seed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    tree_t *tree = pipeline->seeded ? build_tree_seeded(pipeline->n_messages, seed) :
+      build_tree(pipeline->n_messages);
+    explicit_bzero(seed, sizeof(seed));
+    pthread_mutex_lock(&pipeline->lock);
+
+    pipeline->ready[pipeline->n_ready++] = tree;
+    pipeline->built++;
+    pthread_cond_signal(&pipeline->available);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+
+  return 0;
+}
+
+key_pipeline* create_key_pipeline(uint16_t n_messages, uint16_t low_water, uint8_t high_water) {
+  return create_key_pipeline_seeded(n_messages, low_water, high_water, NULL, 0);
+}
+
+key_pipeline* create_key_pipeline_seeded(uint16_t n_messages, uint16_t low_water, uint8_t high_water,
+    uint8_t *seed, uint32_t first) {
+
+  key_pipeline *pipeline = malloc(sizeof(key_pipeline));
+  if(pipeline == NULL) {
+    return NULL;
+  }
+
+  pipeline->seeded = seed != NULL;
+  if(pipeline->seeded) {
+    memcpy(pipeline->seed, seed, SHA256_DIGEST_LENGTH);
+  }
+  pipeline->next = first;
+  pipeline->n_messages = n_messages;
+  pipeline->low_water = low_water;
+  pipeline->high_water = high_water ? high_water : 1;
+  pipeline->ready = malloc(pipeline->high_water*sizeof(tree_t *));
+  pipeline->n_ready = 0;
+  pipeline->remaining = n_messages;
+  pipeline->stop = 0;
+  pipeline->built = 0;
+  pipeline->stalls = 0;
+
+  pthread_mutex_init(&pipeline->lock, NULL);
+  pthread_cond_init(&pipeline->wanted, NULL);
+  pthread_cond_init(&pipeline->available, NULL);
+
+  if(pipeline->ready == NULL ||
+      pthread_create(&pipeline->builder, NULL, build_trees, pipeline)) {
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->wanted);
+    pthread_cond_destroy(&pipeline->available);
+    free(pipeline->ready);
+    free(pipeline);
+    return NULL;
+  }
+
+  return pipeline;
+}
+
+tree_t* key_pipeline_take(key_pipeline *pipeline) {
+
+  pthread_mutex_lock(&pipeline->lock);
+
+  if(pipeline->n_ready == 0) {
+    pipeline->stalls++;
+    while(pipeline->n_ready == 0) {
+      pthread_cond_wait(&pipeline->available, &pipeline->lock);
+    }
+  }
+
+  tree_t *tree = pipeline->ready[0];
+  pipeline->n_ready--;
+  memmove(pipeline->ready, pipeline->ready + 1, pipeline->n_ready*sizeof(tree_t *));
+  pipeline->remaining = pipeline->n_messages;
+
+  pthread_cond_signal(&pipeline->wanted);
+  pthread_mutex_unlock(&pipeline->lock);
+
+  return tree;
+}
+
+void key_pipeline_report(key_pipeline *pipeline, uint32_t remaining) {
+
+  pthread_mutex_lock(&pipeline->lock);
+
+  pipeline->remaining = remaining;
+  if(needs_tree(pipeline)) {
+    pthread_cond_signal(&pipeline->wanted);
+  }
+
+  pthread_mutex_unlock(&pipeline->lock);
+}
+
+void key_pipeline_stats(key_pipeline *pipeline, uint64_t *built, uint32_t *ready, uint64_t *stalls) {
+
+  pthread_mutex_lock(&pipeline->lock);
+
+  if(built != NULL) {
+    *built = pipeline->built;
+  }
+  if(ready != NULL) {
+    *ready = pipeline->n_ready;
+  }
+  if(stalls != NULL) {
+    *stalls = pipeline->stalls;
+  }
+
+  pthread_mutex_unlock(&pipeline->lock);
+}
+
+void free_key_pipeline(key_pipeline *pipeline) {
+
+  pthread_mutex_lock(&pipeline->lock);
+  pipeline->stop = 1;
+  pthread_cond_signal(&pipeline->wanted);
+  pthread_mutex_unlock(&pipeline->lock);
+
+  pthread_join(pipeline->builder, NULL);
+
+  for(int i = 0; i < pipeline->n_ready; ++i) {
+    free_tree(pipeline->ready[i]);
+  }
+
+  pthread_mutex_destroy(&pipeline->lock);
+  pthread_cond_destroy(&pipeline->wanted);
+  pthread_cond_destroy(&pipeline->available);
+  explicit_bzero(pipeline->seed, sizeof(pipeline->seed));
+  free(pipeline->ready);
+  free(pipeline);
+  pipeline = NULL;
+}
@@ -1,4 +1,5 @@
 #include <time.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -7,6 +8,14 @@
 #include "signature.h"
 #include "merkle_tree.h"
 #include "signature_attack.h"
+#include "reuse_index.h"
+#include "multi_proof.h"
+#include "proof_cache.h"
+#include "sharded_signer.h"
+#include "hypertree.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "sha256_lanes.h"
 
 #define N_SIGNATURES 5
 #define N_THREADS 2
@@ -31,6 +40,58 @@ void test_signature(void) {
   } else {
     printf("Bad signature\n");
   }
+
+  // A changed byte in the first or the last signed block must be refused
+  int refused = 0;
+  for(int i = 0; i < 2; ++i) {
+    uint8_t *byte = sign + (i ? (31*8 + 7)*BlockByteSize - 1 : 0);
+    *byte ^= 1;
+    refused += Verify(&public, message, sign) == 0;
+    *byte ^= 1;
+  }
+
+  if(refused == 2) {
+    printf("The tampered signature was refused\n");
+  } else {
+    printf("A tampered signature was accepted\n");
+  }
+}
+
+void test_sha256_blocks(void) {
+
+  printf("Hashing blocks side by side\n");
+
+  int sizes[] = {1, 15, 16, 17, 224};
+  uint8_t data[224][32], digests[224*SHA256_DIGEST_LENGTH], expected[224][SHA256_DIGEST_LENGTH];
+  uint8_t *blocks[224], *hashes[224];
+
+  for(int i = 0; i < 224; ++i) {
+    for(int j = 0; j < 32; ++j) {
+      data[i][j] = rand();
+    }
+    SHA256(data[i], 32, expected[i]);
+    blocks[i] = data[i];
+    hashes[i] = expected[i];
+  }
+
+  for(int i = 0; i < 5; ++i) {
+    int n = sizes[i];
+    sha256_blocks(blocks, digests, n);
+
+    int same = !memcmp(digests, expected, n*SHA256_DIGEST_LENGTH) &&
+      sha256_blocks_compare(blocks, hashes, n) == 0;
+
+    // The last block is the one in the partial group, if there's one
+    expected[n - 1][0] ^= 1;
+    int refused = sha256_blocks_compare(blocks, hashes, n) != 0;
+    expected[n - 1][0] ^= 1;
+
+    if(same && refused) {
+      printf("%d blocks match SHA256\n", n);
+    } else {
+      printf("%d blocks don't match SHA256\n", n);
+    }
+  }
 }
 
 void test_forging_signature(void) {
@@ -67,7 +128,22 @@ void test_forging_signature(void) {
 
   printf("Keys Signed\n");
 
+  // A message without room for the nounce is refused, not overflowed
+  char long_message[FORGED_MESSAGE_SIZE + 1];
+  char out[FORGED_MESSAGE_SIZE];
+  memset(long_message, 'a', FORGED_MESSAGE_SIZE);
+  long_message[FORGED_MESSAGE_SIZE] = '\0';
+  char *longest = long_message + FORGED_MESSAGE_SIZE - MAX_ATTACK_MESSAGE;
+  if(format_nounce(out, long_message, 1, NOUNCE_DECIMAL) != -1 ||
+      format_nounce(out, long_message + 10, 1, NOUNCE_BINARY) != -1 ||
+      format_nounce(out, long_message + 10, ~0ULL, NOUNCE_DECIMAL) != -1 ||
+      format_nounce(out, longest, ~0ULL, NOUNCE_DECIMAL) < 0 ||
+      format_nounce(out, longest, ~0ULL, NOUNCE_BINARY) < 0) {
+    printf("Long messages aren't handled\n");
+  }
+
   char message_to_forge[] = {"Message forged - mikael_ferraz@hotmail.com"};
+  char *templates[] = {message_to_forge, "Forged - mikael_ferraz@hotmail.com"};
   uint8_t false_signature[256*BlockByteSize];
 
   printf("Forging Signature... \n");
@@ -78,22 +154,33 @@ void test_forging_signature(void) {
   values.signs = &signs;
   values.message = message_to_forge;
   values.forge = false_signature;
+  values.templates = templates;
+  values.n_templates = 2;
+  values.max_seconds = 600;
+  values.max_attempts = 0;
+  values.affinity = POOL_COMPACT;
 
   clock_t time = clock();
 
   unsigned long long int nounce = attack_lamport(&values);
 
   time = clock() - time;
-  printf("It took %fs with %d threads to forge the signature\n", ((double)time)/CLOCKS_PER_SEC, N_THREADS);
-  char message_forged[100] = {0};
-  sprintf(message_forged, "%s + %llu", message_to_forge, nounce);
-  printf("%s\n", message_forged);
 
   for(int i = 0; i < N_SIGNATURES; ++i) {
     free(signs.sign[i]);
   }
   free(signs.sign);
 
+  if(nounce == ATTACK_ABORTED) {
+    printf("Attack was not attempted\n");
+    return;
+  }
+
+  printf("It took %fs with %d threads to forge the signature\n", ((double)time)/CLOCKS_PER_SEC, N_THREADS);
+  char message_forged[FORGED_MESSAGE_SIZE] = {0};
+  format_nounce(message_forged, values.message, nounce, values.encoding);
+  printf("%s\n", message_forged);
+
   if(Verify(&public, message_forged, false_signature)) {
     printf("The signature was successfully forged\n");
   } else {
@@ -115,7 +202,9 @@ void test_merkle_tree(void) {
     merkle_test = merkle_signature(merkle_tree, message);
 
     if(merkle_test == NULL) {
-      printf("No more keys available\n");
+      size_t live, reclaimed;
+      get_tree_memory(merkle_tree, &live, &reclaimed);
+      printf("No more keys available, %zu bytes live and %zu reclaimed\n", live, reclaimed);
       free_tree(merkle_tree);
       return;
     }
@@ -131,6 +220,254 @@ void test_merkle_tree(void) {
   free_tree(merkle_tree);
 }
 
+void test_key_reuse(void) {
+
+  printf("Detecting reused keys\n");
+
+  tree_t *merkle_tree = build_tree(4);
+  reuse_index *index = create_reuse_index(4, NULL);
+
+  char message[] = "Signed once";
+  merkle_sign *first = merkle_signature(merkle_tree, message);
+  merkle_sign *second = merkle_signature(merkle_tree, message);
+
+  int ret[3];
+  ret[0] = verify_prove_unique(index, get_public_hash(merkle_tree), message, first);
+  ret[1] = verify_prove_unique(index, get_public_hash(merkle_tree), message, second);
+  ret[2] = verify_prove_unique(index, get_public_hash(merkle_tree), message, first);
+
+  if(ret[0] == KEY_FIRST_USE && ret[1] == KEY_FIRST_USE && ret[2] == KEY_REUSED) {
+    printf("The reused key was detected\n");
+  } else {
+    printf("Key reuse went unnoticed\n");
+  }
+
+  free_merkle_signature(first);
+  free_merkle_signature(second);
+  free_reuse_index(index);
+  free_tree(merkle_tree);
+}
+
+void test_prepared_signatures(void) {
+
+  printf("Signing from prepared signatures\n");
+
+  tree_t *merkle_tree = build_tree(16);
+  reuse_index *index = create_reuse_index(16, NULL);
+  set_tree_lookahead(merkle_tree, 4);
+  precompute_signatures(merkle_tree, 0);
+
+  char message[] = "Prepared ahead";
+  merkle_sign *signs[17];
+  int n = 0;
+
+  // Leaves 0 and 1 come out of the ring, leaves 2 and 3 stay queued
+  signs[n++] = merkle_signature(merkle_tree, message);
+  signs[n++] = merkle_signature(merkle_tree, message);
+
+  // A queued leaf signed directly must be skipped by the ring
+  signs[n++] = merkle_signature_leaf(merkle_tree, 3, message);
+  if(merkle_signature_leaf(merkle_tree, 3, message) != NULL) {
+    printf("The leaf signed directly was signed again\n");
+  }
+
+  // Shrinking the ring drops what's queued, those leaves aren't lost
+  set_tree_lookahead(merkle_tree, 2);
+  precompute_signatures(merkle_tree, 0);
+
+  while(n < 17 && (signs[n] = merkle_signature(merkle_tree, message)) != NULL) {
+    ++n;
+    precompute_signatures(merkle_tree, 1);
+  }
+
+  int valid = 0;
+  for(int i = 0; i < n; ++i) {
+    if(signs[i] != NULL &&
+        verify_prove_unique(index, get_public_hash(merkle_tree), message, signs[i]) == KEY_FIRST_USE) {
+      valid++;
+    }
+    if(signs[i] != NULL) {
+      free_merkle_signature(signs[i]);
+    }
+  }
+
+  printf("%d of 16 leaves signed once and within the tree\n", valid);
+
+  free_reuse_index(index);
+  free_tree(merkle_tree);
+}
+
+void test_proof_cache(void) {
+
+  printf("Verifying through a proof cache\n");
+
+  tree_t *merkle_tree = build_tree(16);
+  proof_cache *cache = create_proof_cache(64);
+  proof_cache *tiny = create_proof_cache(2);
+
+  char message[] = "Cached proof";
+  merkle_sign *signs[8];
+  int valid = 0, tiny_valid = 0;
+
+  for(int i = 0; i < 8; ++i) {
+    signs[i] = merkle_signature(merkle_tree, message);
+    valid += verify_prove_cached(cache, get_public_hash(merkle_tree), message, signs[i]);
+    tiny_valid += verify_prove_cached(tiny, get_public_hash(merkle_tree), message, signs[i]);
+  }
+
+  uint64_t hits, evictions;
+  proof_cache_stats(cache, &hits, NULL, NULL);
+  printf("%d of 8 signatures within the tree, %lu nodes found in the cache\n", valid,
+      (unsigned long) hits);
+
+  proof_cache_stats(tiny, NULL, NULL, &evictions);
+  printf("%d of 8 signatures within the tree with 2 nodes cached, %lu evicted\n", tiny_valid,
+      (unsigned long) evictions);
+
+  // The path of the first signature is cached, a changed Lamport block or
+  // key must still be refused
+  uint16_t size;
+  uint8_t *bytes = get_merkle_sign_bytes(signs[0], &size);
+  int refused = 0;
+  for(int i = 0; i < 2; ++i) {
+    uint8_t *byte = bytes + (i ? BlockByteSize*256 : 0);
+    *byte ^= 1;
+    refused += !verify_prove_cached(cache, get_public_hash(merkle_tree), message, signs[0]);
+    *byte ^= 1;
+  }
+
+  if(refused == 2) {
+    printf("The tampered signature was refused on a cache hit\n");
+  } else {
+    printf("A tampered signature was accepted from the cache\n");
+  }
+
+  for(int i = 0; i < 8; ++i) {
+    free_merkle_signature(signs[i]);
+  }
+  free_proof_cache(tiny);
+  free_proof_cache(cache);
+  free_tree(merkle_tree);
+}
+
+void test_multi_proof(void) {
+
+  printf("Signing a batch with one multi proof\n");
+
+  tree_t *merkle_tree = build_tree(16);
+
+  char *messages[] = {"Batch[0]", "Batch[1]", "Batch[2]", "Batch[3]", "Batch[4]"};
+  multi_sign *batch = merkle_multi_signature(merkle_tree, messages, 5);
+
+  if(verify_multi_prove(get_public_hash(merkle_tree), messages, 5, batch)) {
+    printf("The batch is within the tree with %u hashes instead of %d\n",
+        get_multi_sign_hashes(batch), 5*4);
+  } else {
+    printf("The multi proof doesn't match with the public hash\n");
+  }
+
+  // Published as bytes and read back, a cut proof is refused
+  uint32_t size;
+  uint8_t *bytes = get_multi_sign_bytes(batch, &size);
+  multi_sign *copy = copy_multi_signature(NULL, bytes, size);
+  if(!verify_multi_prove(get_public_hash(merkle_tree), messages, 5, copy)) {
+    printf("The multi proof read back doesn't match\n");
+  }
+  copy = copy_multi_signature(copy, bytes, size - SHA256_DIGEST_LENGTH);
+  if(verify_multi_prove(get_public_hash(merkle_tree), messages, 5, copy) ||
+      verify_multi_prove_bytes(get_public_hash(merkle_tree), messages, 5, bytes, 2)) {
+    printf("A cut multi proof was accepted\n");
+  }
+  free_multi_signature(copy);
+
+  // A proof for more messages than the batch has is refused unread
+  if(verify_multi_prove_bytes(get_public_hash(merkle_tree), messages, 4, bytes, size)) {
+    printf("A multi proof for another number of messages was accepted\n");
+  }
+
+  free_multi_signature(batch);
+  free_tree(merkle_tree);
+}
+
+typedef struct ShardTest {
+  sharded_signer *signer;
+  uint16_t shard;
+  int valid;
+} shardTest;
+
+void *sign_from_shard(void *args) {
+
+  shardTest *test = (shardTest *) args;
+  char message[] = "Signed by a shard";
+  merkle_sign *signature;
+
+  test->valid = 0;
+  for(int i = 0; i < 4; ++i) {
+    signature = sharded_signature(test->signer, test->shard, message);
+    test->valid += verify_prove(get_sharded_public_hash(test->signer), message, signature);
+    free_merkle_signature(signature);
+  }
+
+  return 0;
+}
+
+void test_sharded_signer(void) {
+
+  printf("Signing from %d shards at the same time\n", N_THREADS);
+
+  sharded_signer *signer = build_sharded_signer(N_THREADS, 4);
+
+  pthread_t threads[N_THREADS];
+  shardTest tests[N_THREADS];
+  int valid = 0;
+
+  for(int i = 0; i < N_THREADS; ++i) {
+    tests[i].signer = signer;
+    tests[i].shard = i;
+    pthread_create(&threads[i], NULL, sign_from_shard, &tests[i]);
+  }
+  for(int i = 0; i < N_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+    valid += tests[i].valid;
+  }
+
+  printf("%d of %d signatures are within the sharded tree\n", valid, 4*N_THREADS);
+
+  if(sharded_signature(signer, 0, "No keys left") == NULL) {
+    printf("No more keys available\n");
+  }
+
+  free_sharded_signer(signer);
+}
+
+void test_hypertree(void) {
+
+  printf("Signing with a hypertree of 3 layers\n");
+
+  hypertree *tree = build_hypertree(3, 2);
+  hypertree_use_pipeline(tree, 1, 2);
+
+  char message[] = "Testing hypertree signature";
+  hyper_sign *signature;
+  for(int i = 0; i < 9; ++i) {
+    signature = hypertree_signature(tree, message);
+
+    if(signature == NULL) {
+      printf("No more keys available\n");
+      break;
+    }
+
+    if(verify_hyper_prove(get_hypertree_public_hash(tree), message, signature)) {
+      printf("The signature is within the hypertree\n");
+    } else {
+      printf("The prove doesn't match with the public hash\n");
+    }
+    free_hyper_signature(signature);
+  }
+
+  free_hypertree(tree);
+}
+
 int main(void) {
 
   uint8_t k = 0;
@@ -138,9 +475,25 @@ int main(void) {
 
   test_signature();
 
+  test_sha256_blocks();
+
   test_forging_signature();
 
   test_merkle_tree();
 
+  test_key_reuse();
+
+  test_prepared_signatures();
+
+  test_proof_cache();
+
+  test_multi_proof();
+
+  test_sharded_signer();
+
+  test_hypertree();
+
+  STATS_DUMP(stdout, STATS_TEXT);
+
   return 0;
 }
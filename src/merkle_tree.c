@@ -1,47 +1,98 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "signature.h"
 #include "merkle_tree.h"
+#include "merkle_tree_internal.h"
+#include "allocator.h"
+#include "stats.h"
 
-struct Leaf_t {
-  key prv;
-  key pub;
-  int available;
-  node_t *parent;
-};
-
-struct Node_t {
-  node_t *upper_node;
-  node_t *right_node;
-  node_t *left_node;
-  leaf_t *leaf;
-  uint8_t data[SHA256_DIGEST_LENGTH];
-};
-
-struct Tree_t {
-  node_t *root;
-  leaf_t **keys;
-  uint16_t key_ctrl;
-};
-
-struct Merkle_sign {
-  uint8_t *sign;
-  uint16_t size;
-};
+#define SIGN_POOL_SIZE 32
+
+typedef struct Sign_pool {
+  merkle_sign *signatures[SIGN_POOL_SIZE];
+  int count;
+  int registered;
+} sign_pool_t;
+
+// Signatures given back by free_merkle_signature, reused with their buffer.
+// Each thread has its own, so signing from many threads takes no lock.
+static _Thread_local sign_pool_t sign_pool;
+static pthread_key_t sign_pool_key;
+static pthread_once_t sign_pool_once = PTHREAD_ONCE_INIT;
+
+// Frees the signatures a thread kept when it ends
+static void free_sign_pool(void *args) {
+
+  sign_pool_t *pool = (sign_pool_t *) args;
+
+  while(pool->count > 0) {
+    merkle_sign *signature = pool->signatures[--pool->count];
+    free(signature->sign);
+    free(signature);
+  }
+}
+
+static void create_sign_pool_key(void) {
+  pthread_key_create(&sign_pool_key, free_sign_pool);
+}
+
+static tree_t* create_tree(uint16_t n_messages, int flags, uint8_t *seed);
 
 tree_t* build_tree(uint16_t n_messages) {
+  return create_tree(n_messages, ALLOC_DEFAULT, NULL);
+}
+
+tree_t* build_tree_flags(uint16_t n_messages, int flags) {
+  return create_tree(n_messages, flags, NULL);
+}
+
+tree_t* build_tree_seeded(uint16_t n_messages, uint8_t *seed) {
+  return create_tree(n_messages, ALLOC_DEFAULT, seed);
+}
+
+static tree_t* create_tree(uint16_t n_messages, int flags, uint8_t *seed) {
+
+  STATS_START(build);
 
   tree_t *merkle_tree = malloc(sizeof(tree_t));
 
+  // Every node, leaf and the key addresses fit in one arena chunk
+  merkle_tree->arena = create_arena(2*n_messages*(sizeof(node_t) + 16) +
+      n_messages*(sizeof(leaf_t) + sizeof(leaf_t*) + 16), flags & ALLOC_HUGE_PAGES);
+  merkle_tree->key_slab = create_slab(2*sizeof(key), n_messages, flags);
+
+  if(merkle_tree->arena == NULL || merkle_tree->key_slab == NULL) {
+    printf("Can't allocate memory for the tree\n");
+    exit(EXIT_FAILURE);
+  }
+
   // allocate the quantity of addresses to store keys
-  merkle_tree->keys = malloc(n_messages*sizeof(leaf_t*));
+  merkle_tree->keys = arena_alloc(merkle_tree->arena, n_messages*sizeof(leaf_t*));
 
   // How many keys there's in the tree
   merkle_tree->key_ctrl = 0;
 
+  merkle_tree->next_leaf = 0;
+  merkle_tree->prepared = NULL;
+  merkle_tree->lookahead = 0;
+  merkle_tree->prepared_start = 0;
+  merkle_tree->prepared_count = 0;
+  merkle_tree->prepared_leaf = 0;
+
+  merkle_tree->depth = 0;
+  while((1 << merkle_tree->depth) < n_messages) {
+    merkle_tree->depth++;
+  }
+
+  merkle_tree->seed = seed;
   merkle_tree->root = bootstrap_tree(merkle_tree, n_messages);
+  merkle_tree->seed = NULL;
+
+  STATS_ADD(STAT_LEAVES_REMAINING, merkle_tree->key_ctrl);
+  STATS_STOP(TIMER_BUILD_TREE, build);
 
   return merkle_tree;
 }
@@ -50,22 +101,26 @@ void node_set_leaf(node_t *node, leaf_t *leaf) {
 
   SHA256_CTX ctx;
   SHA256_Init(&ctx);
-  SHA256_Update(&ctx, &leaf->pub, sizeof(key));
+  SHA256_Update(&ctx, leaf->pub, sizeof(key));
   SHA256_Final(node->data, &ctx);
+  STATS_HASH(sizeof(key));
 
   leaf->parent = node;
   leaf->available = KEY_AVAILABLE;
+  leaf->reclaimed = 0;
 }
 
 node_t* bootstrap_tree(tree_t *tree, int n) {
 
-  node_t *node = malloc(sizeof(node_t));
+  node_t *node = arena_alloc(tree->arena, sizeof(node_t));
 
   if(node == NULL) {
     printf("Can't allocate memory for the node\n");
     exit(EXIT_FAILURE);
   }
 
+  node->upper_node = NULL;
+
   if(n != 1) {
     node->leaf = NULL;
     node->left_node = bootstrap_tree(tree, n/2);
@@ -74,16 +129,24 @@ node_t* bootstrap_tree(tree_t *tree, int n) {
     return node;
   }
 
-  node->leaf = malloc(sizeof(leaf_t));
+  node->leaf = arena_alloc(tree->arena, sizeof(leaf_t));
   node->left_node = NULL;
   node->right_node = NULL;
 
-  if(node->leaf == NULL) {
+  if(node->leaf == NULL || (node->leaf->prv = slab_alloc(tree->key_slab)) == NULL) {
     printf("Can't allocate memory for the leaf\n");
     exit(EXIT_FAILURE);
   }
+  node->leaf->pub = node->leaf->prv + 1;
 
-  GenerateKeys(&node->leaf->prv, &node->leaf->pub);
+  if(tree->seed != NULL) {
+    uint8_t seed[SHA256_DIGEST_LENGTH];
+    derive_seed(tree->seed, tree->key_ctrl, seed);
+    GenerateKeysFromSeed(node->leaf->prv, node->leaf->pub, seed);
+    explicit_bzero(seed, sizeof(seed));
+  } else {
+    GenerateKeys(node->leaf->prv, node->leaf->pub);
+  }
   node_set_leaf(node, node->leaf);
 
   // Increase the number of keys stored in the tree
@@ -106,58 +169,226 @@ int add_node(node_t *node, node_t *left_node, node_t *right_node) {
   left_node->upper_node = node;
   right_node->upper_node = node;
 
-  // Left and right nodes will always exist
-  uint8_t *temp = malloc(2*SHA256_DIGEST_LENGTH);
-  if(temp == NULL) {
-    return NODE_ERROR;
-  }
-  memcpy(temp, left_node->data, SHA256_DIGEST_LENGTH);
-  memcpy(temp + SHA256_DIGEST_LENGTH, right_node->data, SHA256_DIGEST_LENGTH);
-
-  // Performing hash of the hash of the nodes
+  // Performing hash of the hash of the nodes, left and right nodes will
+  // always exist
   SHA256_CTX ctx;
   SHA256_Init(&ctx);
-  SHA256_Update(&ctx, temp, 2*SHA256_DIGEST_LENGTH);
+  SHA256_Update(&ctx, left_node->data, SHA256_DIGEST_LENGTH);
+  SHA256_Update(&ctx, right_node->data, SHA256_DIGEST_LENGTH);
   SHA256_Final(node->data, &ctx);
-
-  free(temp);
+  STATS_HASH(2*SHA256_DIGEST_LENGTH);
 
   return NODE_SUCCESS;
 }
 
-merkle_sign* merkle_signature(tree_t *tree, char *message) {
+static merkle_sign* take_signature(uint16_t capacity) {
 
-  int i;
+  merkle_sign *signature = NULL;
 
-  for(i = 0; i < tree->key_ctrl; ++i) {
-    if(tree->keys[i]->available == KEY_AVAILABLE) {
-      break;
+  if(sign_pool.count > 0) {
+    signature = sign_pool.signatures[--sign_pool.count];
+  }
+
+  if(signature == NULL) {
+    signature = malloc(sizeof(merkle_sign));
+    if(signature == NULL) {
+      printf("Can't allocate memory for the signature\n");
+      exit(EXIT_FAILURE);
     }
+    signature->sign = NULL;
+    signature->capacity = 0;
   }
 
-  if(i == tree->key_ctrl) {
-    return NULL;
+  if(signature->capacity < capacity) {
+    signature->sign = realloc(signature->sign, capacity);
+    signature->capacity = capacity;
+    if(signature->sign == NULL) {
+      printf("Can't allocate memory for the signature\n");
+      exit(EXIT_FAILURE);
+    }
   }
 
-  merkle_sign *signature = malloc(sizeof(merkle_sign));
-  signature->sign = malloc(BlockByteSize*256);
+  signature->size = 0;
+
+  return signature;
+}
+
+/*
+ * Everything of the signature but the Lamport part: the public key of the
+ * leaf and the path up to the root.
+ */
+static merkle_sign* prepare_signature(tree_t *tree, leaf_t *leaf) {
+
+  merkle_sign *signature = take_signature(PATH_OFFSET + tree->depth*PATH_ENTRY_SIZE);
   signature->size = BlockByteSize*256;
-  Sign(&tree->keys[i]->prv, message, signature->sign);
-  signature->sign = realloc(signature->sign, signature->size + sizeof(key));
-  memcpy(signature->sign + signature->size, (uint8_t *) &tree->keys[i]->pub, sizeof(key));
+  memcpy(signature->sign + signature->size, (uint8_t *) leaf->pub, sizeof(key));
   signature->size = signature->size + sizeof(key);
 
-  construct_signature(tree->root->data, tree->keys[i]->parent, signature);
+  construct_signature(tree->root->data, leaf->parent, signature);
+
+  return signature;
+}
+
+static void sign_prepared(tree_t *tree, leaf_t *leaf, merkle_sign *signature, char *message) {
 
-  tree->keys[i]->available = KEY_NOT_AVAILABLE;
+  Sign(leaf->prv, message, signature->sign);
+  release_leaf(tree, leaf);
+}
+
+/*
+ * Takes the prepared signature of a leaf out of the ring. Entries of
+ * leaves that were signed with merkle_signature_leaf in the meantime are
+ * dropped on the way.
+ */
+static merkle_sign* take_prepared(tree_t *tree, uint16_t index) {
+
+  while(tree->prepared_count > 0) {
+    prepared_t *entry = &tree->prepared[tree->prepared_start];
+    if(entry->index > index) {
+      break;
+    }
+
+    merkle_sign *signature = entry->signature;
+    tree->prepared_start = (tree->prepared_start + 1) % tree->lookahead;
+    tree->prepared_count--;
+
+    if(entry->index == index && tree->keys[index]->available == KEY_AVAILABLE) {
+      return signature;
+    }
+    free_merkle_signature(signature);
+  }
+
+  return NULL;
+}
+
+merkle_sign* merkle_signature(tree_t *tree, char *message) {
+
+  // Leaves are never given back, so the search goes on from the last one
+  while(tree->next_leaf < tree->key_ctrl && tree->keys[tree->next_leaf]->available != KEY_AVAILABLE) {
+    tree->next_leaf++;
+  }
+
+  merkle_sign *signature = take_prepared(tree, tree->next_leaf);
+  if(signature == NULL) {
+    return merkle_signature_leaf(tree, tree->next_leaf, message);
+  }
+
+  STATS_START(merkle);
+
+  sign_prepared(tree, tree->keys[tree->next_leaf], signature, message);
+
+  STATS_ADD(STAT_SIGNATURES_ISSUED, 1);
+  STATS_STOP(TIMER_MERKLE_SIGNATURE, merkle);
 
   return signature;
 }
 
+merkle_sign* merkle_signature_leaf(tree_t *tree, int index, char *message) {
+
+  if(index < 0 || index >= tree->key_ctrl || tree->keys[index]->available != KEY_AVAILABLE) {
+    return NULL;
+  }
+
+  STATS_START(merkle);
+
+  leaf_t *leaf = tree->keys[index];
+
+  merkle_sign *signature = prepare_signature(tree, leaf);
+  sign_prepared(tree, leaf, signature, message);
+
+  STATS_ADD(STAT_SIGNATURES_ISSUED, 1);
+  STATS_STOP(TIMER_MERKLE_SIGNATURE, merkle);
+
+  return signature;
+}
+
+static void drop_prepared(tree_t *tree) {
+
+  while(tree->prepared_count > 0) {
+    free_merkle_signature(tree->prepared[tree->prepared_start].signature);
+    tree->prepared_start = (tree->prepared_start + 1) % tree->lookahead;
+    tree->prepared_count--;
+  }
+  tree->prepared_start = 0;
+  tree->prepared_leaf = tree->next_leaf;
+}
+
+void set_tree_lookahead(tree_t *tree, uint16_t depth) {
+
+  drop_prepared(tree);
+  free(tree->prepared);
+  tree->prepared = NULL;
+  tree->lookahead = depth;
+
+  if(depth > 0) {
+    tree->prepared = malloc(depth*sizeof(prepared_t));
+    if(tree->prepared == NULL) {
+      printf("Can't allocate memory for the prepared signatures\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int precompute_signatures(tree_t *tree, int max) {
+
+  int n = 0;
+
+  if(tree->prepared_leaf < tree->next_leaf) {
+    tree->prepared_leaf = tree->next_leaf;
+  }
+
+  while(tree->prepared_count < tree->lookahead && (max <= 0 || n < max)) {
+    while(tree->prepared_leaf < tree->key_ctrl &&
+        tree->keys[tree->prepared_leaf]->available != KEY_AVAILABLE) {
+      tree->prepared_leaf++;
+    }
+    if(tree->prepared_leaf == tree->key_ctrl) {
+      break;
+    }
+
+    prepared_t *entry = &tree->prepared[(tree->prepared_start + tree->prepared_count) % tree->lookahead];
+    entry->index = tree->prepared_leaf;
+    entry->signature = prepare_signature(tree, tree->keys[tree->prepared_leaf]);
+    tree->prepared_count++;
+    tree->prepared_leaf++;
+    n++;
+  }
+
+  return n;
+}
+
+void release_leaf(tree_t *tree, leaf_t *leaf) {
+
+  leaf->available = KEY_NOT_AVAILABLE;
+  STATS_ADD(STAT_LEAVES_REMAINING, -1);
+  leaf->reclaimed = slab_discard(tree->key_slab, leaf->prv);
+}
+
+void get_tree_memory(tree_t *tree, size_t *live, size_t *reclaimed) {
+
+  // Keys that were only wiped still hold their pages
+  size_t released = 0;
+  for(int i = 0; i < tree->key_ctrl; ++i) {
+    if(tree->keys[i]->available == KEY_NOT_AVAILABLE && tree->keys[i]->reclaimed) {
+      released++;
+    }
+  }
+
+  if(live != NULL) {
+    *live = arena_mapped(tree->arena) + (tree->key_ctrl - released)*2*sizeof(key);
+  }
+  if(reclaimed != NULL) {
+    *reclaimed = released*2*sizeof(key);
+  }
+}
+
 void construct_signature(uint8_t *pub_hash, node_t *node, merkle_sign *sign) {
 
   if(memcmp(node->data, pub_hash, SHA256_DIGEST_LENGTH)) {
-    sign->sign = realloc(sign->sign, sign->size + SHA256_DIGEST_LENGTH + 1);
+    if(sign->capacity < sign->size + SHA256_DIGEST_LENGTH + 1) {
+      sign->capacity = sign->size + SHA256_DIGEST_LENGTH + 1;
+      sign->sign = realloc(sign->sign, sign->capacity);
+    }
     if(node->upper_node->right_node != node) {
       sign->sign[sign->size] = 0;
       memcpy(sign->sign + sign->size + 1, node->upper_node->right_node->data, SHA256_DIGEST_LENGTH);
@@ -171,33 +402,60 @@ void construct_signature(uint8_t *pub_hash, node_t *node, merkle_sign *sign) {
 }
 
 uint8_t verify_prove(uint8_t *pub, char* message, merkle_sign* signature) {
+  return verify_prove_leaf(pub, message, signature, NULL);
+}
+
+uint8_t verify_prove_leaf(uint8_t *pub, char* message, merkle_sign* signature, uint8_t *leaf_hash) {
+
+  STATS_START(prove);
+
+  uint8_t result[SHA256_DIGEST_LENGTH];
+  uint8_t ret = prove_root(message, signature, leaf_hash, result) &&
+      !memcmp(result, pub, SHA256_DIGEST_LENGTH);
+
+  STATS_ADD(ret ? STAT_SIGNATURES_VERIFIED : STAT_SIGNATURES_REJECTED, 1);
+  STATS_STOP(TIMER_VERIFY_PROVE, prove);
+
+  return ret;
+}
+
+uint8_t prove_root(char* message, merkle_sign* signature, uint8_t *leaf_hash, uint8_t *root) {
+
+  // Stored or received signatures may be cut anywhere
+  if(signature->size < PATH_OFFSET || (signature->size - PATH_OFFSET) % PATH_ENTRY_SIZE) {
+    return 0;
+  }
 
   key leaf_key;
   memcpy(&leaf_key, signature->sign + BlockByteSize*256, sizeof(key));
   if(Verify(&leaf_key, message, signature->sign)) {
-    uint8_t result[SHA256_DIGEST_LENGTH], temp[2*SHA256_DIGEST_LENGTH];
+    uint8_t temp[2*SHA256_DIGEST_LENGTH];
     SHA256_CTX ctx;
 
     SHA256_Init(&ctx);
     SHA256_Update(&ctx, &leaf_key, sizeof(key));
-    SHA256_Final(result, &ctx);
+    SHA256_Final(root, &ctx);
+    STATS_HASH(sizeof(key));
+
+    if(leaf_hash != NULL) {
+      memcpy(leaf_hash, root, SHA256_DIGEST_LENGTH);
+    }
 
     for(int i = BlockByteSize*256 + sizeof(key); i < signature->size; i += SHA256_DIGEST_LENGTH + 1) {
       if(signature->sign[i]) {
         memcpy(temp, &signature->sign[i+1], SHA256_DIGEST_LENGTH);
-        memcpy(temp + SHA256_DIGEST_LENGTH, result, SHA256_DIGEST_LENGTH);
+        memcpy(temp + SHA256_DIGEST_LENGTH, root, SHA256_DIGEST_LENGTH);
       } else {
-        memcpy(temp, result, SHA256_DIGEST_LENGTH);
+        memcpy(temp, root, SHA256_DIGEST_LENGTH);
         memcpy(temp + SHA256_DIGEST_LENGTH, &signature->sign[i+1], SHA256_DIGEST_LENGTH);
       }
       SHA256_Init(&ctx);
       SHA256_Update(&ctx, temp, 2*SHA256_DIGEST_LENGTH);
-      SHA256_Final(result, &ctx);
+      SHA256_Final(root, &ctx);
+      STATS_HASH(2*SHA256_DIGEST_LENGTH);
     }
 
-    if(!memcmp(result, pub, SHA256_DIGEST_LENGTH)) {
-      return 1;
-    }
+    return 1;
   }
 
   return 0;
@@ -236,17 +494,68 @@ void print_tree(node_t *node) {
   printf("\n");
 }
 
+uint8_t* get_merkle_sign_bytes(merkle_sign *signature, uint16_t *size) {
+
+  *size = signature->size;
+
+  return signature->sign;
+}
+
+merkle_sign* copy_merkle_signature(merkle_sign *signature, uint8_t *bytes, uint16_t size) {
+
+  if(signature == NULL) {
+    signature = take_signature(size);
+  } else if(signature->capacity < size) {
+    signature->sign = realloc(signature->sign, size);
+    signature->capacity = size;
+    if(signature->sign == NULL) {
+      printf("Can't allocate memory for the signature\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  memcpy(signature->sign, bytes, size);
+  signature->size = size;
+
+  return signature;
+}
+
 void free_merkle_signature(merkle_sign* signature) {
 
-  free(signature->sign);
-  free(signature);
-  signature = NULL;
+  if(!sign_pool.registered) {
+    pthread_once(&sign_pool_once, create_sign_pool_key);
+    pthread_setspecific(sign_pool_key, &sign_pool);
+    sign_pool.registered = 1;
+  }
+
+  if(sign_pool.count < SIGN_POOL_SIZE) {
+    sign_pool.signatures[sign_pool.count++] = signature;
+    signature = NULL;
+  }
+
+  if(signature != NULL) {
+    free(signature->sign);
+    free(signature);
+    signature = NULL;
+  }
 }
 
 void free_tree(tree_t *tree) {
 
-  free_node(tree->root);
-  free(tree->keys);
+#ifdef LAMPORT_STATS
+  for(int i = 0; i < tree->key_ctrl; ++i) {
+    if(tree->keys[i]->available == KEY_AVAILABLE) {
+      STATS_ADD(STAT_LEAVES_REMAINING, -1);
+    }
+  }
+#endif
+
+  drop_prepared(tree);
+  free(tree->prepared);
+
+  // Nodes, leaves and keys go away with their arena and slab
+  free_arena(tree->arena);
+  free_slab(tree->key_slab);
   tree->keys = NULL;
   free(tree);
   tree = NULL;
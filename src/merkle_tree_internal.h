@@ -0,0 +1,96 @@
+#ifndef MERKLE_TREE_INTERNAL_H
+#define MERKLE_TREE_INTERNAL_H
+
+/*
+ *  Layout of the merkle tree and of its signatures, shared by the
+ *  modules that work on them directly. Applications only see the
+ *  opaque types in merkle_tree.h.
+ *
+ *  A merkle signature is the Lamport signature (BlockByteSize*256 bytes),
+ *  the leaf public key (sizeof(key) bytes) and one PATH_ENTRY_SIZE entry
+ *  per level up to the root: a byte that is 1 when the node is the right
+ *  child, followed by the hash of its sibling.
+ */
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "allocator.h"
+
+#define PATH_OFFSET (BlockByteSize*256 + sizeof(key))
+#define PATH_ENTRY_SIZE (SHA256_DIGEST_LENGTH + 1)
+
+/*
+ * The private and public keys of a leaf are one 32 KB object of the
+ * tree's key slab, the private key first.
+ */
+struct Leaf_t {
+  key *prv;
+  key *pub;
+  int available;
+  // The pages of the key went back to the system when it was used
+  int reclaimed;
+  node_t *parent;
+};
+
+struct Node_t {
+  node_t *upper_node;
+  node_t *right_node;
+  node_t *left_node;
+  leaf_t *leaf;
+  uint8_t data[SHA256_DIGEST_LENGTH];
+};
+
+/*
+ * A signature buffer that already holds the public key and the path of
+ * its leaf, only the Lamport signature is missing.
+ */
+typedef struct Prepared {
+  uint16_t index;
+  merkle_sign *signature;
+} prepared_t;
+
+struct Tree_t {
+  node_t *root;
+  leaf_t **keys;
+  uint16_t key_ctrl;
+  uint8_t depth;
+  arena_t *arena;
+  slab_t *key_slab;
+
+  // Where the keys come from while the tree is built, rand() without it
+  uint8_t *seed;
+
+  // No leaf before this one is available
+  uint16_t next_leaf;
+
+  // Ring of prepared signatures for the leaves after next_leaf, in order
+  prepared_t *prepared;
+  uint16_t lookahead;
+  uint16_t prepared_start;
+  uint16_t prepared_count;
+  uint16_t prepared_leaf;
+};
+
+struct Merkle_sign {
+  uint8_t *sign;
+  uint16_t size;
+  uint16_t capacity;
+};
+
+/*
+ * @Function:
+ *  release_leaf
+ *
+ * @Description:
+ *  Marks the key of the leaf as used, wipes both halves of the key pair
+ *  and gives their pages back. The public key must have been copied
+ *  into the signature before.
+ *
+ * @Parameters:
+ *  The tree and the leaf.
+ *
+ * @Returns: None
+ */
+void release_leaf(tree_t *tree, leaf_t *leaf);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "merkle_tree_internal.h"
+#include "multi_proof.h"
+#include "stats.h"
+
+#define MULTI_HEADER_SIZE 3
+#define MULTI_KEY_SIZE (BlockByteSize*256 + sizeof(key))
+
+struct Multi_sign {
+  uint8_t *sign;
+  uint32_t size;
+};
+
+static void hash_pair(uint8_t *left, uint8_t *right, uint8_t *result) {
+
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, left, SHA256_DIGEST_LENGTH);
+  SHA256_Update(&ctx, right, SHA256_DIGEST_LENGTH);
+  SHA256_Final(result, &ctx);
+  STATS_HASH(2*SHA256_DIGEST_LENGTH);
+}
+
+multi_sign* merkle_multi_signature(tree_t *tree, char **messages, uint16_t n_messages) {
+
+  uint8_t depth = tree->depth;
+
+  uint32_t *indexes = malloc(n_messages*sizeof(uint32_t));
+  node_t **nodes = malloc(n_messages*sizeof(node_t *));
+  if(n_messages == 0 || indexes == NULL || nodes == NULL) {
+    free(indexes);
+    free(nodes);
+    return NULL;
+  }
+
+  uint16_t n = 0;
+  for(int i = 0; i < tree->key_ctrl && n < n_messages; ++i) {
+    if(tree->keys[i]->available == KEY_AVAILABLE) {
+      indexes[n++] = i;
+    }
+  }
+
+  if(n < n_messages) {
+    free(indexes);
+    free(nodes);
+    return NULL;
+  }
+
+  // At most one sibling per leaf per level is needed
+  multi_sign *signature = malloc(sizeof(multi_sign));
+  uint32_t keys_end = MULTI_HEADER_SIZE + n*(sizeof(uint32_t) + MULTI_KEY_SIZE);
+  if(signature == NULL || (signature->sign = malloc(keys_end + n*depth*SHA256_DIGEST_LENGTH)) == NULL) {
+    printf("Can't allocate memory for the multi signature\n");
+    exit(EXIT_FAILURE);
+  }
+  signature->size = keys_end;
+
+  signature->sign[0] = depth;
+  memcpy(signature->sign + 1, &n, sizeof(uint16_t));
+  memcpy(signature->sign + MULTI_HEADER_SIZE, indexes, n*sizeof(uint32_t));
+
+  uint8_t *keys = signature->sign + MULTI_HEADER_SIZE + n*sizeof(uint32_t);
+  for(int i = 0; i < n; ++i) {
+    leaf_t *leaf = tree->keys[indexes[i]];
+    Sign(leaf->prv, messages[i], keys + i*MULTI_KEY_SIZE);
+    memcpy(keys + i*MULTI_KEY_SIZE + BlockByteSize*256, leaf->pub, sizeof(key));
+    nodes[i] = leaf->parent;
+    release_leaf(tree, leaf);
+  }
+
+  // Climb one level at a time, two nodes of the batch with the same parent
+  // need no hash from the proof
+  for(int level = 0; level < depth; ++level) {
+    int next = 0;
+    for(int i = 0; i < n; ++i) {
+      node_t *upper = nodes[i]->upper_node;
+      if(i + 1 < n && nodes[i + 1]->upper_node == upper) {
+        i++;
+      } else {
+        node_t *sibling = (upper->left_node == nodes[i]) ? upper->right_node : upper->left_node;
+        memcpy(signature->sign + signature->size, sibling->data, SHA256_DIGEST_LENGTH);
+        signature->size += SHA256_DIGEST_LENGTH;
+      }
+      nodes[next++] = upper;
+    }
+    n = next;
+  }
+
+  free(indexes);
+  free(nodes);
+
+  STATS_ADD(STAT_SIGNATURES_ISSUED, n_messages);
+
+  return signature;
+}
+
+uint8_t verify_multi_prove(uint8_t *pub, char **messages, uint16_t n_messages, multi_sign *signature) {
+  return verify_multi_prove_bytes(pub, messages, n_messages, signature->sign, signature->size);
+}
+
+uint8_t verify_multi_prove_bytes(uint8_t *pub, char **messages, uint16_t n_messages, uint8_t *bytes,
+    uint32_t size) {
+
+  // Stored or received proofs may be cut anywhere
+  if(size < MULTI_HEADER_SIZE) {
+    return 0;
+  }
+
+  uint8_t depth = bytes[0];
+  uint16_t n;
+  memcpy(&n, bytes + 1, sizeof(uint16_t));
+
+  // The count comes from the proof, there must be as many messages
+  uint32_t keys_end = MULTI_HEADER_SIZE + n*(sizeof(uint32_t) + MULTI_KEY_SIZE);
+  if(n == 0 || n != n_messages || depth > 32 || size < keys_end || (size - keys_end) % SHA256_DIGEST_LENGTH ||
+      (size - keys_end)/SHA256_DIGEST_LENGTH > (uint32_t) n*depth) {
+    return 0;
+  }
+
+  uint32_t *indexes = malloc(n*sizeof(uint32_t));
+  uint8_t (*hashes)[SHA256_DIGEST_LENGTH] = malloc(n*SHA256_DIGEST_LENGTH);
+  if(indexes == NULL || hashes == NULL) {
+    free(indexes);
+    free(hashes);
+    return 0;
+  }
+  memcpy(indexes, bytes + MULTI_HEADER_SIZE, n*sizeof(uint32_t));
+
+  uint8_t ret = 0;
+  uint8_t *keys = bytes + MULTI_HEADER_SIZE + n*sizeof(uint32_t);
+  uint8_t *proof = bytes + keys_end;
+  uint8_t *proof_end = bytes + size;
+
+  for(int i = 0; i < n; ++i) {
+    if((depth < 32 && indexes[i] >> depth) || (i > 0 && indexes[i] <= indexes[i - 1])) {
+      goto end;
+    }
+
+    // The bytes may not be aligned for a key
+    key leaf_key;
+    memcpy(&leaf_key, keys + i*MULTI_KEY_SIZE + BlockByteSize*256, sizeof(key));
+    if(!Verify(&leaf_key, messages[i], keys + i*MULTI_KEY_SIZE)) {
+      goto end;
+    }
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &leaf_key, sizeof(key));
+    SHA256_Final(hashes[i], &ctx);
+    STATS_HASH(sizeof(key));
+  }
+
+  for(int level = 0; level < depth; ++level) {
+    int next = 0;
+    for(int i = 0; i < n; ++i) {
+      if(!(indexes[i] & 1) && i + 1 < n && indexes[i + 1] == indexes[i] + 1) {
+        hash_pair(hashes[i], hashes[i + 1], hashes[next]);
+        i++;
+      } else {
+        if(proof == proof_end) {
+          goto end;
+        }
+        if(indexes[i] & 1) {
+          hash_pair(proof, hashes[i], hashes[next]);
+        } else {
+          hash_pair(hashes[i], proof, hashes[next]);
+        }
+        proof += SHA256_DIGEST_LENGTH;
+      }
+      indexes[next++] = indexes[i] >> 1;
+    }
+    n = next;
+  }
+
+  ret = (proof == proof_end && !memcmp(hashes[0], pub, SHA256_DIGEST_LENGTH));
+
+end:
+  STATS_ADD(ret ? STAT_SIGNATURES_VERIFIED : STAT_SIGNATURES_REJECTED, 1);
+  free(indexes);
+  free(hashes);
+
+  return ret;
+}
+
+uint32_t get_multi_sign_hashes(multi_sign *signature) {
+
+  uint16_t n;
+  if(signature->size < MULTI_HEADER_SIZE) {
+    return 0;
+  }
+  memcpy(&n, signature->sign + 1, sizeof(uint16_t));
+
+  uint32_t keys_end = MULTI_HEADER_SIZE + n*(sizeof(uint32_t) + MULTI_KEY_SIZE);
+  if(signature->size < keys_end) {
+    return 0;
+  }
+
+  return (signature->size - keys_end)/SHA256_DIGEST_LENGTH;
+}
+
+uint8_t* get_multi_sign_bytes(multi_sign *signature, uint32_t *size) {
+
+  *size = signature->size;
+
+  return signature->sign;
+}
+
+multi_sign* copy_multi_signature(multi_sign *signature, uint8_t *bytes, uint32_t size) {
+
+  if(signature == NULL) {
+    signature = malloc(sizeof(multi_sign));
+    if(signature == NULL) {
+      printf("Can't allocate memory for the multi signature\n");
+      exit(EXIT_FAILURE);
+    }
+    signature->sign = NULL;
+  }
+
+  // The buffer may be bigger than the bytes it holds, realloc keeps it
+  signature->sign = realloc(signature->sign, size ? size : 1);
+  if(signature->sign == NULL) {
+    printf("Can't allocate memory for the multi signature\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(signature->sign, bytes, size);
+  signature->size = size;
+
+  return signature;
+}
+
+void free_multi_signature(multi_sign *signature) {
+
+  free(signature->sign);
+  free(signature);
+  signature = NULL;
+}
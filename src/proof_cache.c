@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "merkle_tree_internal.h"
+#include "proof_cache.h"
+#include "stats.h"
+
+#define NO_ENTRY 0xFFFFFFFF
+
+typedef struct Cache_entry {
+  uint8_t root[SHA256_DIGEST_LENGTH];
+  uint8_t data[SHA256_DIGEST_LENGTH];
+  uint64_t index;
+  uint16_t level;
+  uint32_t chain;
+  uint32_t newer;
+  uint32_t older;
+} cache_entry;
+
+struct Proof_cache {
+  cache_entry *entries;
+  uint32_t *buckets;
+  uint32_t bucket_mask;
+  uint32_t max_nodes;
+  uint32_t used;
+  uint32_t newest;
+  uint32_t oldest;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+static uint32_t bucket_of(proof_cache *cache, uint8_t *root, uint16_t level, uint64_t index) {
+
+  uint64_t h;
+  memcpy(&h, root, sizeof(h));
+  h ^= (index + 1) * 0x9E3779B97F4A7C15ULL;
+  h ^= (uint64_t) level * 0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 29;
+
+  return (uint32_t) h & cache->bucket_mask;
+}
+
+static void unlink_lru(proof_cache *cache, uint32_t e) {
+
+  cache_entry *entry = &cache->entries[e];
+
+  if(entry->newer != NO_ENTRY) {
+    cache->entries[entry->newer].older = entry->older;
+  } else {
+    cache->newest = entry->older;
+  }
+  if(entry->older != NO_ENTRY) {
+    cache->entries[entry->older].newer = entry->newer;
+  } else {
+    cache->oldest = entry->newer;
+  }
+}
+
+static void push_newest(proof_cache *cache, uint32_t e) {
+
+  cache->entries[e].older = cache->newest;
+  cache->entries[e].newer = NO_ENTRY;
+  if(cache->newest != NO_ENTRY) {
+    cache->entries[cache->newest].newer = e;
+  } else {
+    cache->oldest = e;
+  }
+  cache->newest = e;
+}
+
+static uint32_t lookup(proof_cache *cache, uint8_t *root, uint16_t level, uint64_t index) {
+
+  uint32_t e = cache->buckets[bucket_of(cache, root, level, index)];
+
+  while(e != NO_ENTRY) {
+    cache_entry *entry = &cache->entries[e];
+    if(entry->index == index && entry->level == level &&
+        !memcmp(entry->root, root, SHA256_DIGEST_LENGTH)) {
+      return e;
+    }
+    e = entry->chain;
+  }
+
+  return NO_ENTRY;
+}
+
+static void evict_oldest(proof_cache *cache) {
+
+  uint32_t e = cache->oldest;
+  cache_entry *entry = &cache->entries[e];
+  uint32_t *link = &cache->buckets[bucket_of(cache, entry->root, entry->level, entry->index)];
+
+  while(*link != e) {
+    link = &cache->entries[*link].chain;
+  }
+  *link = entry->chain;
+
+  unlink_lru(cache, e);
+  cache->evictions++;
+}
+
+static void insert(proof_cache *cache, uint8_t *root, uint16_t level, uint64_t index, uint8_t *data) {
+
+  uint32_t e = lookup(cache, root, level, index);
+
+  if(e != NO_ENTRY) {
+    unlink_lru(cache, e);
+    push_newest(cache, e);
+    return;
+  }
+
+  if(cache->used < cache->max_nodes) {
+    e = cache->used++;
+  } else {
+    e = cache->oldest;
+    evict_oldest(cache);
+  }
+
+  cache_entry *entry = &cache->entries[e];
+  memcpy(entry->root, root, SHA256_DIGEST_LENGTH);
+  memcpy(entry->data, data, SHA256_DIGEST_LENGTH);
+  entry->level = level;
+  entry->index = index;
+
+  uint32_t bucket = bucket_of(cache, root, level, index);
+  entry->chain = cache->buckets[bucket];
+  cache->buckets[bucket] = e;
+
+  push_newest(cache, e);
+}
+
+proof_cache* create_proof_cache(uint32_t max_nodes) {
+
+  if(max_nodes == 0 || max_nodes >= NO_ENTRY) {
+    return NULL;
+  }
+
+  proof_cache *cache = malloc(sizeof(proof_cache));
+  if(cache == NULL) {
+    return NULL;
+  }
+
+  uint32_t n_buckets = 1;
+  while(n_buckets < max_nodes && n_buckets < 0x80000000) {
+    n_buckets *= 2;
+  }
+
+  cache->entries = malloc(max_nodes*sizeof(cache_entry));
+  cache->buckets = malloc(n_buckets*sizeof(uint32_t));
+  if(cache->entries == NULL || cache->buckets == NULL) {
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+    return NULL;
+  }
+
+  memset(cache->buckets, 0xFF, n_buckets*sizeof(uint32_t));
+  cache->bucket_mask = n_buckets - 1;
+  cache->max_nodes = max_nodes;
+  cache->used = 0;
+  cache->newest = NO_ENTRY;
+  cache->oldest = NO_ENTRY;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+
+  return cache;
+}
+
+static uint8_t prove_cached(proof_cache *cache, uint8_t *pub, char *message, merkle_sign *signature) {
+
+  key *leaf_key = (key *) (signature->sign + BlockByteSize*256);
+  if(signature->size < PATH_OFFSET || (signature->size - PATH_OFFSET) % PATH_ENTRY_SIZE ||
+      !Verify(leaf_key, message, signature->sign)) {
+    return 0;
+  }
+
+  int depth = (signature->size - PATH_OFFSET)/PATH_ENTRY_SIZE;
+  if(depth > 64) {
+    return 0;
+  }
+
+  // The side bytes spell the index of the leaf, lowest level first
+  uint8_t *path = signature->sign + PATH_OFFSET;
+  uint64_t leaf_index = 0;
+  for(int level = 0; level < depth; ++level) {
+    if(path[level*PATH_ENTRY_SIZE]) {
+      leaf_index |= 1ULL << level;
+    }
+  }
+
+  uint8_t nodes[64][SHA256_DIGEST_LENGTH], top[SHA256_DIGEST_LENGTH];
+  uint8_t temp[2*SHA256_DIGEST_LENGTH];
+  uint8_t *result = nodes[0];
+  int climbed = depth;
+  SHA256_CTX ctx;
+
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, leaf_key, sizeof(key));
+  SHA256_Final(result, &ctx);
+  STATS_HASH(sizeof(key));
+
+  for(int level = 0; level < depth; ++level) {
+    uint8_t *entry = path + level*PATH_ENTRY_SIZE;
+    if(entry[0]) {
+      memcpy(temp, entry + 1, SHA256_DIGEST_LENGTH);
+      memcpy(temp + SHA256_DIGEST_LENGTH, result, SHA256_DIGEST_LENGTH);
+    } else {
+      memcpy(temp, result, SHA256_DIGEST_LENGTH);
+      memcpy(temp + SHA256_DIGEST_LENGTH, entry + 1, SHA256_DIGEST_LENGTH);
+    }
+
+    result = (level + 1 == depth) ? top : nodes[level + 1];
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, temp, 2*SHA256_DIGEST_LENGTH);
+    SHA256_Final(result, &ctx);
+    STATS_HASH(2*SHA256_DIGEST_LENGTH);
+
+    if(level + 1 == depth) {
+      break;
+    }
+
+    uint32_t e = lookup(cache, pub, level + 1, leaf_index >> (level + 1));
+    if(e == NO_ENTRY) {
+      cache->misses++;
+      continue;
+    }
+
+    // A proven node sits here, the rest of the path is already known
+    cache->hits++;
+    unlink_lru(cache, e);
+    push_newest(cache, e);
+    if(memcmp(cache->entries[e].data, result, SHA256_DIGEST_LENGTH)) {
+      return 0;
+    }
+    climbed = level + 1;
+    break;
+  }
+
+  if(climbed == depth && memcmp(result, pub, SHA256_DIGEST_LENGTH)) {
+    return 0;
+  }
+
+  // Upper levels last, so they're the last to be evicted
+  for(int level = 1; level < climbed; ++level) {
+    insert(cache, pub, level, leaf_index >> level, nodes[level]);
+  }
+
+  return 1;
+}
+
+uint8_t verify_prove_cached(proof_cache *cache, uint8_t *pub, char *message, merkle_sign *signature) {
+
+  STATS_START(prove);
+
+  uint8_t ret = prove_cached(cache, pub, message, signature);
+
+  STATS_ADD(ret ? STAT_SIGNATURES_VERIFIED : STAT_SIGNATURES_REJECTED, 1);
+  STATS_STOP(TIMER_VERIFY_PROVE, prove);
+
+  return ret;
+}
+
+void proof_cache_stats(proof_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions) {
+
+  if(hits != NULL) {
+    *hits = cache->hits;
+  }
+  if(misses != NULL) {
+    *misses = cache->misses;
+  }
+  if(evictions != NULL) {
+    *evictions = cache->evictions;
+  }
+}
+
+void free_proof_cache(proof_cache *cache) {
+
+  free(cache->entries);
+  free(cache->buckets);
+  free(cache);
+  cache = NULL;
+}
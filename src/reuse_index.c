@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "reuse_index.h"
+#include "stats.h"
+
+#define INDEX_MAGIC 0x4C414D5052455553ULL
+#define INDEX_MIN_CAPACITY 1024
+
+typedef struct Index_header {
+  uint64_t magic;
+  uint64_t capacity;
+  uint64_t count;
+  uint64_t reserved;
+} index_header;
+
+struct Reuse_index {
+  index_header *header;
+  uint8_t (*slots)[SHA256_DIGEST_LENGTH];
+  size_t map_size;
+  char *path;
+  pthread_mutex_t lock;
+};
+
+static const uint8_t empty_slot[SHA256_DIGEST_LENGTH] = {0};
+
+/*
+ * A file written by an earlier run is only trusted if its capacity can be
+ * probed with a mask, matches the file size and still has empty slots.
+ */
+static int valid_header(index_header *header, off_t file_size) {
+
+  uint64_t capacity = header->capacity;
+
+  return capacity >= INDEX_MIN_CAPACITY && !(capacity & (capacity - 1)) &&
+    capacity <= (SIZE_MAX - sizeof(index_header))/SHA256_DIGEST_LENGTH &&
+    file_size == (off_t) (sizeof(index_header) + capacity*SHA256_DIGEST_LENGTH) &&
+    2*header->count <= capacity;
+}
+
+/*
+ * Maps a table with the given number of slots. With a path the table is
+ * backed by that file, and a valid table already there is kept as is. A
+ * file with the magic of a table but a broken header is refused rather
+ * than wiped, it may be the only record of the keys used.
+ */
+static int map_table(reuse_index *index, char *path, uint64_t capacity) {
+
+  size_t size = sizeof(index_header) + capacity*SHA256_DIGEST_LENGTH;
+  void *map;
+
+  if(path == NULL) {
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if(fd < 0) {
+      return INDEX_ERROR;
+    }
+
+    struct stat st;
+    index_header old;
+    if(fstat(fd, &st) == 0 && (size_t) st.st_size > sizeof(index_header) &&
+        pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.magic == INDEX_MAGIC) {
+      if(!valid_header(&old, st.st_size)) {
+        close(fd);
+        return INDEX_ERROR;
+      }
+      size = st.st_size;
+    } else if(ftruncate(fd, 0) || ftruncate(fd, size)) {
+      close(fd);
+      return INDEX_ERROR;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+
+  if(map == MAP_FAILED) {
+    return INDEX_ERROR;
+  }
+
+  index->header = map;
+  index->slots = (uint8_t (*)[SHA256_DIGEST_LENGTH]) (index->header + 1);
+  index->map_size = size;
+
+  if(index->header->magic != INDEX_MAGIC) {
+    index->header->magic = INDEX_MAGIC;
+    index->header->capacity = capacity;
+    index->header->count = 0;
+  }
+
+  return KEY_FIRST_USE;
+}
+
+static void place(reuse_index *index, uint8_t *leaf_hash, uint64_t slot) {
+  memcpy(index->slots[slot], leaf_hash, SHA256_DIGEST_LENGTH);
+  index->header->count++;
+}
+
+/*
+ * Leaf hashes are SHA-256 outputs, so their first bytes are already a
+ * uniform hash of the key.
+ */
+static uint64_t find_slot(reuse_index *index, uint8_t *leaf_hash) {
+
+  uint64_t mask = index->header->capacity - 1;
+  uint64_t slot;
+  memcpy(&slot, leaf_hash, sizeof(slot));
+  slot &= mask;
+
+  while(memcmp(index->slots[slot], empty_slot, SHA256_DIGEST_LENGTH) &&
+      memcmp(index->slots[slot], leaf_hash, SHA256_DIGEST_LENGTH)) {
+    slot = (slot + 1) & mask;
+  }
+
+  return slot;
+}
+
+/*
+ * Makes a rename in the directory of the file durable.
+ */
+static int sync_directory(char *path) {
+
+  char *slash = strrchr(path, '/');
+  char *dir = ".";
+
+  if(slash != NULL) {
+    dir = malloc(slash - path + 2);
+    if(dir == NULL) {
+      return INDEX_ERROR;
+    }
+    memcpy(dir, path, slash - path + 1);
+    dir[slash - path + 1] = '\0';
+  }
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  int ret = fd >= 0 && fsync(fd) == 0;
+  if(fd >= 0) {
+    close(fd);
+  }
+  if(slash != NULL) {
+    free(dir);
+  }
+
+  return ret ? KEY_FIRST_USE : INDEX_ERROR;
+}
+
+/*
+ * Doubles the table. A file backed table is rebuilt next to the old one,
+ * written out and renamed over it, so the file is never left half
+ * rehashed. If the rename fails the old table stays in use.
+ */
+static int grow(reuse_index *index) {
+
+  reuse_index bigger;
+  char *tmp = NULL;
+
+  if(index->path != NULL) {
+    tmp = malloc(strlen(index->path) + sizeof(".tmp"));
+    if(tmp == NULL) {
+      return INDEX_ERROR;
+    }
+    sprintf(tmp, "%s.tmp", index->path);
+    unlink(tmp);
+  }
+
+  if(!map_table(&bigger, tmp, 2*index->header->capacity)) {
+    free(tmp);
+    return INDEX_ERROR;
+  }
+
+  for(uint64_t i = 0; i < index->header->capacity; ++i) {
+    if(memcmp(index->slots[i], empty_slot, SHA256_DIGEST_LENGTH)) {
+      place(&bigger, index->slots[i], find_slot(&bigger, index->slots[i]));
+    }
+  }
+
+  int ret = KEY_FIRST_USE;
+  if(tmp != NULL) {
+    if(msync(bigger.header, bigger.map_size, MS_SYNC) || rename(tmp, index->path)) {
+      munmap(bigger.header, bigger.map_size);
+      unlink(tmp);
+      free(tmp);
+      return INDEX_ERROR;
+    }
+    free(tmp);
+    ret = sync_directory(index->path);
+  }
+
+  munmap(index->header, index->map_size);
+  index->header = bigger.header;
+  index->slots = bigger.slots;
+  index->map_size = bigger.map_size;
+
+  return ret;
+}
+
+reuse_index* create_reuse_index(uint64_t capacity, char *path) {
+
+  reuse_index *index = malloc(sizeof(reuse_index));
+  if(index == NULL) {
+    return NULL;
+  }
+
+  // Keep the load factor under one half so probes stay short
+  uint64_t slots = INDEX_MIN_CAPACITY;
+  while(slots < 2*capacity) {
+    slots *= 2;
+  }
+
+  index->path = NULL;
+  if(path != NULL) {
+    index->path = malloc(strlen(path) + 1);
+    if(index->path == NULL) {
+      free(index);
+      return NULL;
+    }
+    strcpy(index->path, path);
+  }
+
+  if(!map_table(index, index->path, slots)) {
+    free(index->path);
+    free(index);
+    return NULL;
+  }
+
+  pthread_mutex_init(&index->lock, NULL);
+
+  return index;
+}
+
+int reuse_index_insert(reuse_index *index, uint8_t *leaf_hash) {
+
+  int ret = KEY_REUSED;
+
+  pthread_mutex_lock(&index->lock);
+
+  uint64_t slot = find_slot(index, leaf_hash);
+  if(memcmp(index->slots[slot], leaf_hash, SHA256_DIGEST_LENGTH)) {
+    ret = KEY_FIRST_USE;
+
+    // Grow before storing, so a failed grow leaves the key out and the
+    // table never fills up
+    if(2*(index->header->count + 1) > index->header->capacity) {
+      if(!grow(index)) {
+        ret = INDEX_ERROR;
+      } else {
+        slot = find_slot(index, leaf_hash);
+      }
+    }
+    if(ret == KEY_FIRST_USE) {
+      place(index, leaf_hash, slot);
+    }
+  }
+
+  pthread_mutex_unlock(&index->lock);
+
+  return ret;
+}
+
+int reuse_index_insert_key(reuse_index *index, key *pub) {
+
+  uint8_t leaf_hash[SHA256_DIGEST_LENGTH];
+
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, pub, sizeof(key));
+  SHA256_Final(leaf_hash, &ctx);
+  STATS_HASH(sizeof(key));
+
+  return reuse_index_insert(index, leaf_hash);
+}
+
+int verify_prove_unique(reuse_index *index, uint8_t *pub, char *message, merkle_sign *signature) {
+
+  uint8_t leaf_hash[SHA256_DIGEST_LENGTH];
+
+  if(!verify_prove_leaf(pub, message, signature, leaf_hash)) {
+    return 0;
+  }
+
+  return reuse_index_insert(index, leaf_hash);
+}
+
+uint64_t reuse_index_count(reuse_index *index) {
+  return index->header->count;
+}
+
+void free_reuse_index(reuse_index *index) {
+
+  pthread_mutex_destroy(&index->lock);
+  munmap(index->header, index->map_size);
+  free(index->path);
+  free(index);
+  index = NULL;
+}
@@ -0,0 +1,175 @@
+#include "sha256_lanes.h"
+
+#define BLOCK_SIZE 32
+#define DIGEST_SIZE 32
+
+typedef uint32_t lane_t __attribute__((vector_size(4*SHA256_LANES)));
+
+// Built for the widest vectors of the machine, picked when the program loads.
+// ThreadSanitizer can't run the loader's resolver, so it gets the default.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+#define LANES_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LANES_TARGETS
+#endif
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t IV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static uint32_t load_be(const uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void store_be(uint8_t *p, uint32_t x) {
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+/*
+ * One compression from the initial state. The block is the 32 bytes of
+ * the message, the 0x80 byte, zeros and the length, 256 bits. The digests
+ * are stored when there's somewhere to store them, and compared with the
+ * expected ones when there are. Returns the differences.
+ */
+LANES_TARGETS
+static uint32_t hash_lanes(uint8_t *const *blocks, uint8_t **digests, uint8_t *const *expected) {
+
+  lane_t w[16], s[8];
+
+  for(int i = 0; i < 8; ++i) {
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      w[i][l] = load_be(blocks[l] + 4*i);
+    }
+  }
+  for(int i = 8; i < 16; ++i) {
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      w[i][l] = i == 8 ? 0x80000000 : (i == 15 ? 8*BLOCK_SIZE : 0);
+    }
+  }
+  for(int i = 0; i < 8; ++i) {
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      s[i][l] = IV[i];
+    }
+  }
+
+  lane_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for(int i = 0; i < 64; ++i) {
+    lane_t x = w[i & 15];
+    if(i >= 16) {
+      lane_t w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+      lane_t s0 = ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);
+      lane_t s1 = ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);
+      x = x + s0 + w[(i + 9) & 15] + s1;
+      w[i & 15] = x;
+    }
+
+    lane_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + x;
+    lane_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  s[0] += a;
+  s[1] += b;
+  s[2] += c;
+  s[3] += d;
+  s[4] += e;
+  s[5] += f;
+  s[6] += g;
+  s[7] += h;
+
+  if(digests != NULL) {
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      for(int i = 0; i < 8; ++i) {
+        store_be(digests[l] + 4*i, s[i][l]);
+      }
+    }
+  }
+
+  uint32_t diff = 0;
+  if(expected != NULL) {
+    lane_t x = {0};
+    for(int i = 0; i < 8; ++i) {
+      for(int l = 0; l < SHA256_LANES; ++l) {
+        w[i][l] = load_be(expected[l] + 4*i);
+      }
+      x |= s[i] ^ w[i];
+    }
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      diff |= x[l];
+    }
+  }
+
+  return diff;
+}
+
+void sha256_blocks(uint8_t *const *blocks, uint8_t *digests, int n) {
+
+  uint8_t *out[SHA256_LANES];
+
+  for(int i = 0; i < n; i += SHA256_LANES) {
+    int lanes = n - i < SHA256_LANES ? n - i : SHA256_LANES;
+    if(lanes == SHA256_LANES) {
+      for(int l = 0; l < SHA256_LANES; ++l) {
+        out[l] = digests + (i + l)*DIGEST_SIZE;
+      }
+      hash_lanes(blocks + i, out, NULL);
+      continue;
+    }
+
+    // The last lanes hash the first block again, into a scratch digest
+    uint8_t *in[SHA256_LANES];
+    uint8_t scratch[DIGEST_SIZE];
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      in[l] = l < lanes ? blocks[i + l] : blocks[i];
+      out[l] = l < lanes ? digests + (i + l)*DIGEST_SIZE : scratch;
+    }
+    hash_lanes(in, out, NULL);
+  }
+}
+
+uint32_t sha256_blocks_compare(uint8_t *const *blocks, uint8_t *const *expected, int n) {
+
+  uint32_t diff = 0;
+
+  for(int i = 0; i < n; i += SHA256_LANES) {
+    int lanes = n - i < SHA256_LANES ? n - i : SHA256_LANES;
+    if(lanes == SHA256_LANES) {
+      diff |= hash_lanes(blocks + i, NULL, expected + i);
+      continue;
+    }
+
+    // The last lanes check the first block again
+    uint8_t *in[SHA256_LANES], *hash[SHA256_LANES];
+    for(int l = 0; l < SHA256_LANES; ++l) {
+      in[l] = l < lanes ? blocks[i + l] : blocks[i];
+      hash[l] = l < lanes ? expected[i + l] : expected[i];
+    }
+    diff |= hash_lanes(in, NULL, hash);
+  }
+
+  return diff;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "merkle_tree_internal.h"
+#include "sharded_signer.h"
+#include "thread_pool.h"
+
+#define CACHE_LINE 64
+
+typedef struct Shard {
+  _Alignas(CACHE_LINE) atomic_uint next;
+  uint16_t n_messages;
+  tree_t *tree;
+  node_t *top_node;
+} shard_t;
+
+struct Sharded_signer {
+  shard_t *shards;
+  uint16_t n_shards;
+  int n_builders;
+  node_t *top_root;
+};
+
+/*
+ * Each shard is built by a thread pinned to one node, so its keys and
+ * nodes are in that node's memory.
+ */
+static void build_shards(void *args, int thread, int node) {
+
+  sharded_signer *signer = (sharded_signer *) args;
+  (void) node;
+
+  int step = signer->n_builders;
+  for(int i = thread; i < signer->n_shards; i += step) {
+    signer->shards[i].tree = build_tree(signer->shards[i].n_messages);
+  }
+}
+
+/*
+ * The top tree has the shard roots as leaves. Its nodes have no leaf_t,
+ * so free_node can chop it like any other tree.
+ */
+static node_t* build_top_tree(shard_t *shards, int n) {
+
+  node_t *node = malloc(sizeof(node_t));
+
+  if(node == NULL) {
+    printf("Can't allocate memory for the node\n");
+    exit(EXIT_FAILURE);
+  }
+
+  node->leaf = NULL;
+  node->upper_node = NULL;
+
+  if(n != 1) {
+    node->left_node = build_top_tree(shards, n/2);
+    node->right_node = build_top_tree(shards + n/2, n/2);
+    add_node(node, node->left_node, node->right_node);
+    return node;
+  }
+
+  node->left_node = NULL;
+  node->right_node = NULL;
+  memcpy(node->data, get_public_hash(shards->tree), SHA256_DIGEST_LENGTH);
+  shards->top_node = node;
+
+  return node;
+}
+
+sharded_signer* build_sharded_signer(uint16_t n_shards, uint16_t n_messages) {
+
+  // The top tree halves the shards down to one, and build_tree the leaves
+  if(n_shards == 0 || (n_shards & (n_shards - 1)) || n_messages == 0 || (n_messages & (n_messages - 1))) {
+    printf("The number of shards and of messages must be powers of two\n");
+    exit(EXIT_FAILURE);
+  }
+
+  sharded_signer *signer = malloc(sizeof(sharded_signer));
+  if(signer == NULL) {
+    printf("Can't allocate memory for the signer\n");
+    exit(EXIT_FAILURE);
+  }
+  signer->shards = aligned_alloc(CACHE_LINE, n_shards*sizeof(shard_t));
+
+  if(signer->shards == NULL) {
+    printf("Can't allocate memory for the shards\n");
+    exit(EXIT_FAILURE);
+  }
+
+  signer->n_shards = n_shards;
+
+  for(int i = 0; i < n_shards; ++i) {
+    atomic_init(&signer->shards[i].next, 0);
+    signer->shards[i].n_messages = n_messages;
+  }
+
+  // No more builders than CPUs, spread over every node
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  signer->n_builders = n_cpus > 0 && n_cpus < n_shards ? (int) n_cpus : n_shards;
+
+  thread_pool *pool = create_thread_pool(signer->n_builders, POOL_SCATTER);
+  if(pool == NULL) {
+    printf("Can't start the threads\n");
+    exit(EXIT_FAILURE);
+  }
+  thread_pool_run(pool, build_shards, signer);
+  free_thread_pool(pool);
+
+  signer->top_root = build_top_tree(signer->shards, n_shards);
+
+  return signer;
+}
+
+merkle_sign* sharded_signature(sharded_signer *signer, uint16_t shard, char *message) {
+
+  for(int tries = 0; tries < signer->n_shards; ++tries) {
+    shard_t *current = &signer->shards[(shard + tries) % signer->n_shards];
+
+    // Don't keep counting on an exhausted shard
+    if(atomic_load_explicit(&current->next, memory_order_relaxed) >= current->n_messages) {
+      continue;
+    }
+
+    unsigned int index = atomic_fetch_add_explicit(&current->next, 1, memory_order_relaxed);
+    if(index >= current->n_messages) {
+      continue;
+    }
+
+    // The leaf was signed through the tree itself, try the next shard
+    merkle_sign *signature = merkle_signature_leaf(current->tree, index, message);
+    if(signature == NULL) {
+      continue;
+    }
+    construct_signature(signer->top_root->data, current->top_node, signature);
+
+    return signature;
+  }
+
+  return NULL;
+}
+
+uint8_t* get_sharded_public_hash(sharded_signer *signer) {
+  return signer->top_root->data;
+}
+
+void free_sharded_signer(sharded_signer *signer) {
+
+  for(int i = 0; i < signer->n_shards; ++i) {
+    free_tree(signer->shards[i].tree);
+  }
+  free_node(signer->top_root);
+  free(signer->shards);
+  free(signer);
+  signer = NULL;
+}
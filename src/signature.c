@@ -1,20 +1,20 @@
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "signature.h"
+#include "sha256_lanes.h"
+#include "stats.h"
 
-void GenerateKeys(key* prv, key* pub) {
+// Blocks of the signature that are checked, the last bit of every byte
+// of the hash isn't signed
+#define SIGNED_BLOCKS (SHA256_DIGEST_LENGTH*7)
 
-  int tmp;
-  for(int i = 0; i < BlockByteSize*256; i += 4) {
-    tmp = rand();
-    memcpy(&prv->zero[i], &tmp, sizeof(int));
-    tmp = rand();
-    memcpy(&prv->one[i], &tmp, sizeof(int));
-  }
+// The public key is the hash of every block of the private key
+static void public_key(key* prv, key* pub) {
 
   SHA256_CTX ctx;
 
@@ -29,16 +29,66 @@ void GenerateKeys(key* prv, key* pub) {
     SHA256_Update(&ctx, &prv->one[i], BlockByteSize);
     SHA256_Final(&pub->one[i], &ctx);
   }
+
+  STATS_ADD(STAT_SHA256_BLOCKS, 2*256);
+  STATS_ADD(STAT_BYTES_HASHED, 2*BlockByteSize*256);
+}
+
+void GenerateKeys(key* prv, key* pub) {
+
+  STATS_START(keys);
+
+  int tmp;
+  for(int i = 0; i < BlockByteSize*256; i += 4) {
+    tmp = rand();
+    memcpy(&prv->zero[i], &tmp, sizeof(int));
+    tmp = rand();
+    memcpy(&prv->one[i], &tmp, sizeof(int));
+  }
+
+  public_key(prv, pub);
+
+  STATS_STOP(TIMER_GENERATE_KEYS, keys);
+}
+
+void GenerateKeysFromSeed(key* prv, key* pub, uint8_t *seed) {
+
+  STATS_START(keys);
+
+  // Block i of the zero half comes from index i, of the one half from 256 + i
+  for(int i = 0; i < 256; ++i) {
+    derive_seed(seed, i, &prv->zero[i*BlockByteSize]);
+    derive_seed(seed, 256 + i, &prv->one[i*BlockByteSize]);
+  }
+
+  public_key(prv, pub);
+
+  STATS_STOP(TIMER_GENERATE_KEYS, keys);
+}
+
+void derive_seed(uint8_t *seed, uint32_t index, uint8_t *out) {
+
+  uint8_t bytes[4] = {index, index >> 8, index >> 16, index >> 24};
+
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, seed, SHA256_DIGEST_LENGTH);
+  SHA256_Update(&ctx, bytes, sizeof(bytes));
+  SHA256_Final(out, &ctx);
+  STATS_HASH(SHA256_DIGEST_LENGTH + sizeof(bytes));
 }
 
 void Sign(key* prv, char* message, uint8_t *sign) {
 
+  STATS_START(sign);
+
   unsigned char hash_message[SHA256_DIGEST_LENGTH];
   SHA256_CTX ctx;
 
   SHA256_Init(&ctx);
   SHA256_Update(&ctx, message, strlen(message));
   SHA256_Final(hash_message, &ctx);
+  STATS_HASH(strlen(message));
 
   uint16_t index;
   for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
@@ -51,6 +101,8 @@ void Sign(key* prv, char* message, uint8_t *sign) {
       }
     }
   }
+
+  STATS_STOP(TIMER_SIGN, sign);
 }
 
 int check_hash(uint8_t *block, uint8_t *hash, int n) {
@@ -62,6 +114,7 @@ int check_hash(uint8_t *block, uint8_t *hash, int n) {
   SHA256_Init(&ctx);
   SHA256_Update(&ctx, block, n);
   SHA256_Final(hash_block, &ctx);
+  STATS_HASH(n);
 
   if(memcmp(hash_block, hash, n))
     return 0;
@@ -71,30 +124,36 @@ int check_hash(uint8_t *block, uint8_t *hash, int n) {
 
 int Verify(key* pub, char* message, uint8_t *sign) {
 
+  STATS_START(verify);
+
   unsigned char hash_message[SHA256_DIGEST_LENGTH];
   SHA256_CTX ctx;
 
   SHA256_Init(&ctx);
   SHA256_Update(&ctx, message, strlen(message));
   SHA256_Final(hash_message, &ctx);
+  STATS_HASH(strlen(message));
+
+  uint8_t *blocks[SIGNED_BLOCKS];
+  uint8_t *expected[SIGNED_BLOCKS];
 
+  // The half of the public key is picked by the bit, not by a branch
+  int n = 0;
   uint16_t index;
   for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
     for(int j = 0; j < 7; ++j) {
       index = (i*8 + j)*BlockByteSize;
-      if(hash_message[i] & (1 << (7 - j))) {
-        if(!check_hash(&sign[index], &pub->one[index], BlockByteSize)) {
-          printf("One wrong at block %d\n", i*8 + j);
-          return 0;
-        }
-      } else {
-        if(!check_hash(&sign[index], &pub->zero[index], BlockByteSize)) {
-          printf("Zero wrong at block %d\n", i*8 + j);
-          return 0;
-        }
-      }
+      expected[n] = (uint8_t *) pub + index + ((hash_message[i] >> (7 - j)) & 1)*offsetof(key, one);
+      blocks[n++] = &sign[index];
     }
   }
 
-  return 1;
+  // Every block is hashed and compared, the time doesn't tell which one
+  // was wrong
+  uint32_t diff = sha256_blocks_compare(blocks, expected, SIGNED_BLOCKS);
+  STATS_ADD(STAT_SHA256_BLOCKS, SIGNED_BLOCKS);
+  STATS_ADD(STAT_BYTES_HASHED, SIGNED_BLOCKS*BlockByteSize);
+
+  STATS_STOP(TIMER_VERIFY, verify);
+  return (int) (((uint64_t) diff - 1) >> 63);
 }
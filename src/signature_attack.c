@@ -1,25 +1,36 @@
 
+#include <math.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
 #include <unistd.h>
 
 #include "signature.h"
 #include "signature_attack.h"
+#include "thread_pool.h"
+#include "stats.h"
 
-static unsigned long long int nounce = 0;
+#define CALIBRATION_ROUNDS 20000
+#define NOUNCE_BINARY_BYTES 10
 
 typedef struct ThreadData {
   uint8_t threadID;
-  key *public;
-  key *false_key;
+  uint8_t (*allowed)[256];
   char *message;
+  int encoding;
   unsigned long long int start;
+  unsigned long long int max_attempts;
+  unsigned long long int tried;
+  // Set by the first thread that finds a nounce, the others stop
+  atomic_int *stop;
+  int found;
+  unsigned long long int nounce;
 } threadData;
 
-void copy_signature(key* pub, signatures *clues, key *false_key) {
+void copy_signature(key* pub, signatures *clues, key *false_key, uint8_t *mask) {
 
   printf("Copying Signatures...\n");
 
@@ -39,66 +50,236 @@ void copy_signature(key* pub, signatures *clues, key *false_key) {
 
       if(one && zero) break;
     }
+
+    mask[i] = (one ? COVER_ONE : 0) | (zero ? COVER_ZERO : 0);
   }
 
   printf("Done\n");
 }
 
+int format_nounce(char *out, char *message, unsigned long long int count, int encoding) {
+
+  int len = snprintf(out, FORGED_MESSAGE_SIZE, "%s + ", message);
+  if(len < 0 || len >= FORGED_MESSAGE_SIZE) {
+    out[0] = '\0';
+    return -1;
+  }
+
+  if(encoding == NOUNCE_BINARY) {
+    if(len + NOUNCE_BINARY_BYTES >= FORGED_MESSAGE_SIZE) {
+      out[0] = '\0';
+      return -1;
+    }
+    for(int i = 0; i < NOUNCE_BINARY_BYTES; ++i) {
+      out[len++] = (char) (0x80 | (count & 0x7F));
+      count >>= 7;
+    }
+    out[len] = '\0';
+    return len;
+  }
+
+  int digits = snprintf(out + len, FORGED_MESSAGE_SIZE - len, "%llu", count);
+  if(digits < 0 || len + digits >= FORGED_MESSAGE_SIZE) {
+    out[0] = '\0';
+    return -1;
+  }
+
+  return len + digits;
+}
+
+/*
+ * For every byte of the message hash, which values only use the blocks
+ * that were copied. Sign and Verify use the first seven bits of each byte.
+ */
+static void build_allowed(uint8_t *mask, uint8_t allowed[SHA256_DIGEST_LENGTH][256]) {
+
+  for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+    for(int value = 0; value < 256; ++value) {
+      allowed[i][value] = 1;
+      for(int j = 0; j < 7; ++j) {
+        if(!(mask[i*8 + j] & ((value & (1 << (7 - j))) ? COVER_ONE : COVER_ZERO))) {
+          allowed[i][value] = 0;
+          break;
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Hashes the message with the given nounce starting from the state of the
+ * constant prefix. Returns the first byte of the hash that uses a block we
+ * don't have, or SHA256_DIGEST_LENGTH if the whole hash is covered.
+ */
+static int try_nounce(SHA256_CTX *prefix, int prefix_len, char *buffer, char *message,
+    unsigned long long int count, int encoding, uint8_t (*allowed)[256]) {
+
+  unsigned char hash_message[SHA256_DIGEST_LENGTH];
+  SHA256_CTX ctx = *prefix;
+
+  int len = format_nounce(buffer, message, count, encoding);
+  SHA256_Update(&ctx, buffer + prefix_len, len - prefix_len);
+  SHA256_Final(hash_message, &ctx);
+  STATS_HASH(len - prefix_len);
+
+  int i;
+  for(i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+    if(!allowed[i][hash_message[i]]) break;
+  }
+
+  return i;
+}
+
+/*
+ * The message and the " + " never change, so the full SHA-256 blocks they
+ * fill are hashed only once.
+ */
+static int hash_prefix(SHA256_CTX *ctx, char *buffer, char *message, int encoding) {
+
+  int len = format_nounce(buffer, message, 0, encoding);
+  int prefix_len = (len - (encoding == NOUNCE_BINARY ? NOUNCE_BINARY_BYTES : 1));
+  prefix_len -= prefix_len % SHA256_CBLOCK;
+
+  SHA256_Init(ctx);
+  SHA256_Update(ctx, buffer, prefix_len);
+
+  return prefix_len;
+}
+
 void *forge_signature(void *args) {
 
   threadData *thData = (threadData *) args;
 
   uint8_t id = thData->threadID;
-  key *public = thData->public;
-  key *false_key = thData->false_key;
   char *message = thData->message;
   unsigned long long int count = thData->start;
+  unsigned long long int end = thData->start + thData->max_attempts;
+
+  char new_message[FORGED_MESSAGE_SIZE] = {0};
+  int depth, depth_max = 0;
+
+  SHA256_CTX prefix;
+  int prefix_len = hash_prefix(&prefix, new_message, message, thData->encoding);
+
+  thData->found = 0;
+  while(!atomic_load_explicit(thData->stop, memory_order_relaxed) &&
+      (!thData->max_attempts || count != end)) {
+    depth = try_nounce(&prefix, prefix_len, new_message, message, count,
+        thData->encoding, thData->allowed);
+
+    if(depth == SHA256_DIGEST_LENGTH) {
+      thData->found = 1;
+      thData->nounce = count;
+      atomic_store_explicit(thData->stop, 1, memory_order_relaxed);
+      count++;
+      break;
+    }
 
-  char new_message[100] = {0};
+    if(depth > depth_max) {
+      depth_max = depth;
+      printf("thread: %d, Block Max: %d, counter: %llu\n", id, 8*depth, count);
+    }
+    count++;
+  }
 
-  unsigned char hash_message[SHA256_DIGEST_LENGTH];
-  uint16_t index, index_max = 0;
+  thData->tried = count - thData->start;
 
-  SHA256_CTX ctx;
+  return 0;
+}
+
+typedef struct Forge_args {
+  threadData *threads;
+  replica_t *allowed;
+} forgeArgs;
 
-  sprintf(new_message, "%s + %llu", message, count);
+static void forge_task(void *args, int thread, int node) {
+
+  forgeArgs *values = (forgeArgs *) args;
+
+  values->threads[thread].allowed = get_replica(values->allowed, node);
+  forge_signature(&values->threads[thread]);
+}
 
-  int16_t i = 0;
-  while(i < SHA256_DIGEST_LENGTH) {
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, new_message, strlen(new_message));
-    SHA256_Final(hash_message, &ctx);
+int estimate_forgery(attackArgs *values, uint8_t *mask, estimate *cost) {
 
+  uint8_t allowed[SHA256_DIGEST_LENGTH][256];
+  build_allowed(mask, allowed);
+
+  // Each bit with only one known block halves the chance of a nounce
+  cost->blocked = 0;
+  cost->free_bits = 0;
+  for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
     for(int j = 0; j < 7; ++j) {
-      index = (i*8 + j)*BlockByteSize;
-      if((hash_message[i] & (1 << (7 - j))) &&
-          !check_hash(&false_key->one[index], &public->one[index], BlockByteSize)) {
-        if(index > index_max) {
-          index_max = index;
-          printf("thread: %d, Block Max: %d, counter: %llu\n", id, 8*i + j, count);
-        }
-        sprintf(new_message, "%s + %llu", message, ++count);
-        i = -1;
-        break;
-      } else if(!(hash_message[i] & (1 << (7 - j))) &&
-          !check_hash(&false_key->zero[index], &public->zero[index], BlockByteSize)) {
-        if(index > index_max) {
-          index_max = index;
-          printf("thread: %d, Block Max: %d, counter: %llu\n", id, 8*i + j, count);
-        }
-        sprintf(new_message, "%s + %llu", message, ++count);
-        i = -1;
-        break;
+      if(mask[i*8 + j] == 0) {
+        cost->blocked = 1;
+      } else if(mask[i*8 + j] != (COVER_ONE | COVER_ZERO)) {
+        cost->free_bits++;
       }
     }
-    i++;
+  }
+  cost->attempts = 1;
+  for(int i = 0; i < cost->free_bits; ++i) {
+    cost->attempts *= 2;
   }
 
-  nounce = count;
+  char **templates = values->templates;
+  int n_templates = values->n_templates;
+  if(templates == NULL || n_templates <= 0) {
+    templates = &values->message;
+    n_templates = 1;
+  }
 
-  return 0;
-}
+  cost->template = -1;
+  cost->encoding = NOUNCE_DECIMAL;
+  cost->hash_rate = 0;
+
+  // No nounce can be found, there's no rate worth measuring
+  if(cost->blocked) {
+    cost->attempts = INFINITY;
+    cost->seconds = INFINITY;
+    for(int t = 0; t < n_templates && cost->template < 0; ++t) {
+      if(strlen(templates[t]) <= MAX_ATTACK_MESSAGE) {
+        cost->template = t;
+      }
+    }
+    return cost->template >= 0;
+  }
+
+  char buffer[FORGED_MESSAGE_SIZE];
+  SHA256_CTX prefix;
 
+  for(int t = 0; t < n_templates; ++t) {
+    if(strlen(templates[t]) > MAX_ATTACK_MESSAGE) {
+      continue;
+    }
+
+    for(int encoding = 0; encoding < N_ENCODINGS; ++encoding) {
+      int prefix_len = hash_prefix(&prefix, buffer, templates[t], encoding);
+
+      clock_t time = clock();
+      for(unsigned long long int count = 0; count < CALIBRATION_ROUNDS; ++count) {
+        try_nounce(&prefix, prefix_len, buffer, templates[t], count, encoding, allowed);
+      }
+      time = clock() - time;
+
+      double rate = CALIBRATION_ROUNDS / (((double)(time ? time : 1))/CLOCKS_PER_SEC);
+      if(cost->template < 0 || rate > cost->hash_rate) {
+        cost->hash_rate = rate;
+        cost->template = t;
+        cost->encoding = encoding;
+      }
+    }
+  }
+
+  if(cost->template < 0) {
+    return 0;
+  }
+
+  int nThreads = values->nThreads > 0 ? values->nThreads : 1;
+  cost->seconds = cost->attempts / (cost->hash_rate * nThreads);
+
+  return 1;
+}
 
 unsigned long long int attack_lamport(attackArgs *values) {
 
@@ -107,54 +288,107 @@ unsigned long long int attack_lamport(attackArgs *values) {
     exit(EXIT_FAILURE);
   }
 
+  if((values->templates == NULL || values->n_templates <= 0) && strlen(values->message) > MAX_ATTACK_MESSAGE) {
+    printf("The message is longer than %d bytes, there's no room for the nounce\n", MAX_ATTACK_MESSAGE);
+    return ATTACK_ABORTED;
+  }
+
   key false_key;
+  uint8_t mask[256];
   memset(false_key.one, 0, BlockByteSize*256);
   memset(false_key.zero, 0, BlockByteSize*256);
 
-  copy_signature(values->pub, values->signs, &false_key);
+  copy_signature(values->pub, values->signs, &false_key, mask);
+
+  values->attempts = 0;
+  values->seconds = 0;
+
+  estimate cost;
+  if(!estimate_forgery(values, mask, &cost)) {
+    printf("Every message is longer than %d bytes, there's no room for the nounce\n", MAX_ATTACK_MESSAGE);
+    return ATTACK_ABORTED;
+  }
+
+  if(values->templates != NULL && values->n_templates > 0) {
+    values->message = values->templates[cost.template];
+  }
+  values->encoding = cost.encoding;
+
+  if(cost.blocked) {
+    printf("Some bits have no block revealed, the signature can't be forged\n");
+    return ATTACK_ABORTED;
+  }
+
+  printf("Expected attempts: 2^%d, %.0f hashes/s per thread, about %.2fs\n",
+      cost.free_bits, cost.hash_rate, cost.seconds);
+
+  if(values->max_seconds > 0 && cost.seconds > values->max_seconds) {
+    printf("The attack would take longer than %.2fs, giving up\n", values->max_seconds);
+    return ATTACK_ABORTED;
+  }
+
+  uint8_t allowed[SHA256_DIGEST_LENGTH][256];
+  build_allowed(mask, allowed);
 
   printf("Searching a Nounce...\n");
 
-  // Creating threads
-  threadData **threads_args;
-  threads_args = malloc((values->nThreads)*sizeof(threadData *));
-  pthread_t **threads;
-  threads = malloc((values->nThreads)*sizeof(pthread_t *));
+  thread_pool *pool = create_thread_pool(values->nThreads, values->affinity);
+  if(pool == NULL) {
+    printf("Can't start the threads\n");
+    exit(EXIT_FAILURE);
+  }
 
-  unsigned long long int split = 18446744073709551615UL - (18446744073709551615UL/(values->nThreads));
+  // Every thread reads the table, each node gets its own copy
+  forgeArgs forge;
+  forge.allowed = create_replica(pool, allowed, sizeof(allowed));
+  forge.threads = malloc((values->nThreads)*sizeof(threadData));
+  threadData *threads_args = forge.threads;
+  if(forge.allowed == NULL || threads_args == NULL) {
+    printf("Can't allocate memory for the threads\n");
+    exit(EXIT_FAILURE);
+  }
+
+  atomic_int found_any;
+  atomic_init(&found_any, 0);
+  unsigned long long int split = 18446744073709551615UL/(values->nThreads);
   int i;
-  for(i = 0; i < (values->nThreads - 1); ++i) {
-    threads_args[i] = malloc(sizeof(threadData));
-    threads_args[i]->threadID = i;
-    threads_args[i]->public = values->pub;
-    threads_args[i]->false_key = &false_key;
-    threads_args[i]->message = values->message;
-    threads_args[i]->start = split*i;
-
-    threads[i] = malloc(sizeof(pthread_t *));
-    pthread_create(threads[i], NULL, forge_signature, threads_args[i]);
-  }
-
-  // One thread will be the program itself
-  threads_args[i] = malloc(sizeof(threadData));
-  threads_args[i]->threadID = i;
-  threads_args[i]->public = values->pub;
-  threads_args[i]->false_key = &false_key;
-  threads_args[i]->message = values->message;
-  threads_args[i]->start = split*i;
-
-  forge_signature(threads_args[i]);
-
-  for(i = 0; i < (values->nThreads - 1); ++i) {
-    free(threads[i]);
-    free(threads_args[i]);
-  }
-  free(threads_args[i]);
-  free(threads);
+  for(i = 0; i < values->nThreads; ++i) {
+    threads_args[i].threadID = i;
+    threads_args[i].message = values->message;
+    threads_args[i].encoding = values->encoding;
+    threads_args[i].start = split*i;
+    threads_args[i].max_attempts = values->max_attempts;
+    threads_args[i].stop = &found_any;
+  }
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  thread_pool_run(pool, forge_task, &forge);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  values->seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)/1e9;
+  int found = 0;
+  unsigned long long int nounce = 0;
+  for(i = 0; i < values->nThreads; ++i) {
+    values->attempts += threads_args[i].tried;
+    if(!found && threads_args[i].found) {
+      found = 1;
+      nounce = threads_args[i].nounce;
+    }
+  }
+
   free(threads_args);
+  free_replica(forge.allowed);
+  free_thread_pool(pool);
+
+  if(!found) {
+    printf("No nounce within %llu attempts per thread\n", values->max_attempts);
+    return ATTACK_ABORTED;
+  }
 
-  char message_forged[100] = {0};
-  sprintf(message_forged, "%s + %llu", values->message, nounce);
+  char message_forged[FORGED_MESSAGE_SIZE] = {0};
+  format_nounce(message_forged, values->message, nounce, values->encoding);
 
   Sign(&false_key, message_forged, values->forge);
 
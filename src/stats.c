@@ -0,0 +1,259 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+#ifdef LAMPORT_STATS
+
+#define SUB_BUCKETS 8
+#define N_BUCKETS (64*SUB_BUCKETS)
+
+typedef struct Thread_stats thread_stats;
+
+struct Thread_stats {
+  int64_t counters[N_STATS];
+  uint64_t histograms[N_TIMERS][N_BUCKETS];
+  uint64_t sums[N_TIMERS];
+  thread_stats *next;
+};
+
+static const char *stat_names[N_STATS] = {
+  "sha256_blocks", "bytes_hashed", "signatures_issued",
+  "signatures_verified", "signatures_rejected", "leaves_remaining"
+};
+
+static const char *timer_names[N_TIMERS] = {
+  "GenerateKeys", "Sign", "Verify", "build_tree", "merkle_signature", "verify_prove"
+};
+
+static const double percentiles[] = {50, 90, 99, 99.9};
+#define N_PERCENTILES (sizeof(percentiles)/sizeof(percentiles[0]))
+
+// Every thread's stats, kept after the thread ends so nothing is lost
+static thread_stats *all_stats = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local thread_stats *local_stats = NULL;
+
+static pthread_t reporter;
+static int reporting = 0;
+static FILE *report_out;
+static int report_format;
+static unsigned int report_interval;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t report_stop = PTHREAD_COND_INITIALIZER;
+
+static thread_stats* get_local(void) {
+
+  if(local_stats == NULL) {
+    local_stats = calloc(1, sizeof(thread_stats));
+    if(local_stats == NULL) {
+      printf("Can't allocate memory for the statistics\n");
+      exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    local_stats->next = all_stats;
+    all_stats = local_stats;
+    pthread_mutex_unlock(&stats_lock);
+  }
+
+  return local_stats;
+}
+
+/*
+ * Log-linear buckets: the position of the highest bit, then the next
+ * three bits below it.
+ */
+static int bucket_of(uint64_t value) {
+
+  if(value < SUB_BUCKETS) {
+    return (int) value;
+  }
+
+  int high = 63 - __builtin_clzll(value);
+  int sub = (int) ((value >> (high - 3)) & (SUB_BUCKETS - 1));
+
+  return (high - 2)*SUB_BUCKETS + sub;
+}
+
+// Upper bound of the values in a bucket
+static uint64_t bucket_value(int bucket) {
+
+  if(bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+
+  int high = bucket/SUB_BUCKETS + 2;
+  uint64_t sub = bucket % SUB_BUCKETS;
+
+  return ((SUB_BUCKETS + sub + 1) << (high - 3)) - 1;
+}
+
+void stats_add(int stat, int64_t n) {
+  get_local()->counters[stat] += n;
+}
+
+void stats_hash(uint64_t bytes) {
+
+  thread_stats *stats = get_local();
+
+  // The padding takes at least 9 bytes
+  stats->counters[STAT_SHA256_BLOCKS] += (bytes + 9 + 63)/64;
+  stats->counters[STAT_BYTES_HASHED] += bytes;
+}
+
+uint64_t stats_now(void) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+void stats_record(int timer, uint64_t nanoseconds) {
+
+  thread_stats *stats = get_local();
+
+  stats->histograms[timer][bucket_of(nanoseconds)]++;
+  stats->sums[timer] += nanoseconds;
+}
+
+void stats_dump(FILE *out, int format) {
+
+  thread_stats *total = calloc(1, sizeof(thread_stats));
+  if(total == NULL) {
+    return;
+  }
+
+  // The other threads keep counting, the sum is a close snapshot
+  pthread_mutex_lock(&stats_lock);
+  for(thread_stats *stats = all_stats; stats != NULL; stats = stats->next) {
+    for(int i = 0; i < N_STATS; ++i) {
+      total->counters[i] += stats->counters[i];
+    }
+    for(int i = 0; i < N_TIMERS; ++i) {
+      total->sums[i] += stats->sums[i];
+      for(int j = 0; j < N_BUCKETS; ++j) {
+        total->histograms[i][j] += stats->histograms[i][j];
+      }
+    }
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  fprintf(out, format == STATS_JSON ? "{\"counters\": {" : "Counters:\n");
+  for(int i = 0; i < N_STATS; ++i) {
+    if(format == STATS_JSON) {
+      fprintf(out, "%s\"%s\": %lld", i ? ", " : "", stat_names[i], (long long) total->counters[i]);
+    } else {
+      fprintf(out, "  %-20s %lld\n", stat_names[i], (long long) total->counters[i]);
+    }
+  }
+  fprintf(out, format == STATS_JSON ? "}, \"latency_ns\": {" : "Latency (ns):\n");
+
+  for(int i = 0; i < N_TIMERS; ++i) {
+    uint64_t count = 0, max = 0;
+    for(int j = 0; j < N_BUCKETS; ++j) {
+      count += total->histograms[i][j];
+      if(total->histograms[i][j]) {
+        max = bucket_value(j);
+      }
+    }
+
+    uint64_t values[N_PERCENTILES] = {0};
+    uint64_t seen = 0;
+    unsigned int p = 0;
+    for(int j = 0; j < N_BUCKETS && p < N_PERCENTILES; ++j) {
+      seen += total->histograms[i][j];
+      while(p < N_PERCENTILES && count && seen >= percentiles[p]*count/100) {
+        values[p++] = bucket_value(j);
+      }
+    }
+
+    double mean = count ? (double) total->sums[i]/count : 0;
+
+    if(format == STATS_JSON) {
+      fprintf(out, "%s\"%s\": {\"count\": %llu, \"mean\": %.0f, \"p50\": %llu, \"p90\": %llu, "
+          "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}", i ? ", " : "", timer_names[i],
+          (unsigned long long) count, mean, (unsigned long long) values[0],
+          (unsigned long long) values[1], (unsigned long long) values[2],
+          (unsigned long long) values[3], (unsigned long long) max);
+    } else {
+      fprintf(out, "  %-16s count %llu mean %.0f p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+          timer_names[i], (unsigned long long) count, mean, (unsigned long long) values[0],
+          (unsigned long long) values[1], (unsigned long long) values[2],
+          (unsigned long long) values[3], (unsigned long long) max);
+    }
+  }
+
+  if(format == STATS_JSON) {
+    fprintf(out, "}}\n");
+  }
+  fflush(out);
+
+  free(total);
+}
+
+static void *report(void *args) {
+
+  (void) args;
+
+  pthread_mutex_lock(&report_lock);
+  while(reporting) {
+    struct timespec wake;
+    clock_gettime(CLOCK_REALTIME, &wake);
+    wake.tv_sec += report_interval/1000;
+    wake.tv_nsec += (report_interval % 1000)*1000000L;
+    if(wake.tv_nsec >= 1000000000L) {
+      wake.tv_sec++;
+      wake.tv_nsec -= 1000000000L;
+    }
+
+    pthread_cond_timedwait(&report_stop, &report_lock, &wake);
+    if(reporting) {
+      stats_dump(report_out, report_format);
+    }
+  }
+  pthread_mutex_unlock(&report_lock);
+
+  return 0;
+}
+
+void stats_start_reporter(FILE *out, int format, unsigned int interval_ms) {
+
+  pthread_mutex_lock(&report_lock);
+  if(reporting) {
+    pthread_mutex_unlock(&report_lock);
+    return;
+  }
+  reporting = 1;
+  report_out = out;
+  report_format = format;
+  report_interval = interval_ms ? interval_ms : 1000;
+  pthread_mutex_unlock(&report_lock);
+
+  pthread_create(&reporter, NULL, report, NULL);
+}
+
+void stats_stop_reporter(void) {
+
+  pthread_mutex_lock(&report_lock);
+  if(!reporting) {
+    pthread_mutex_unlock(&report_lock);
+    return;
+  }
+  reporting = 0;
+  pthread_cond_signal(&report_stop);
+  pthread_mutex_unlock(&report_lock);
+
+  pthread_join(reporter, NULL);
+}
+
+#else
+
+// ISO C doesn't allow an empty file
+typedef int stats_disabled;
+
+#endif
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "allocator.h"
+#include "thread_pool.h"
+
+typedef struct Pool_thread {
+  thread_pool *pool;
+  pthread_t id;
+  int index;
+  int node;
+  cpu_set_t cpus;
+} pool_thread;
+
+struct Thread_pool {
+  int n_threads;
+  int policy;
+  pool_thread *threads;
+
+  // The CPUs of each node, node by node
+  int n_nodes;
+  int *cpus;
+  int node_start[POOL_MAX_NODES + 1];
+  int leader[POOL_MAX_NODES];
+
+  pool_task task;
+  void *args;
+  uint64_t generation;
+  int running;
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  pthread_mutex_t run_lock;
+};
+
+struct Replica {
+  int n_nodes;
+  size_t size;
+  void *copies[POOL_MAX_NODES];
+  int owned[POOL_MAX_NODES];
+};
+
+typedef struct Replica_args {
+  thread_pool *pool;
+  replica_t *replica;
+  void *data;
+} replica_args;
+
+/*
+ * Adds the CPUs of a list like "0-3,8-11" that the process may use.
+ */
+static void add_cpu_list(thread_pool *pool, char *list, cpu_set_t *allowed) {
+
+  char *position = list;
+  while(*position != '\0' && *position != '\n') {
+    char *end;
+    long first = strtol(position, &end, 10), last = first;
+    if(end == position) {
+      break;
+    }
+    if(*end == '-') {
+      position = end + 1;
+      last = strtol(position, &end, 10);
+    }
+    for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      if(CPU_ISSET(cpu, allowed)) {
+        pool->cpus[pool->node_start[pool->n_nodes + 1]++] = (int) cpu;
+      }
+    }
+    position = (*end == ',') ? end + 1 : end;
+  }
+}
+
+static void read_topology(thread_pool *pool) {
+
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+
+  pool->n_nodes = 0;
+  pool->node_start[0] = 0;
+
+  char path[64], list[4096];
+  for(int node = 0; node < POOL_MAX_NODES && pool->n_nodes < POOL_MAX_NODES; ++node) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+      continue;
+    }
+    if(fgets(list, sizeof(list), file) != NULL) {
+      pool->node_start[pool->n_nodes + 1] = pool->node_start[pool->n_nodes];
+      add_cpu_list(pool, list, &allowed);
+      // Nodes with memory only, or none of our CPUs, don't count
+      if(pool->node_start[pool->n_nodes + 1] > pool->node_start[pool->n_nodes]) {
+        pool->n_nodes++;
+      }
+    }
+    fclose(file);
+  }
+
+  if(pool->n_nodes == 0) {
+    pool->node_start[1] = 0;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if(CPU_ISSET(cpu, &allowed)) {
+        pool->cpus[pool->node_start[1]++] = cpu;
+      }
+    }
+    pool->n_nodes = 1;
+  }
+}
+
+static int node_size(thread_pool *pool, int node) {
+  return pool->node_start[node + 1] - pool->node_start[node];
+}
+
+static void place_thread(thread_pool *pool, pool_thread *thread) {
+
+  int i = thread->index;
+  int total = pool->node_start[pool->n_nodes];
+  int node = 0, cpu = -1;
+
+  CPU_ZERO(&thread->cpus);
+
+  switch(pool->policy) {
+    case POOL_COMPACT:
+      cpu = pool->cpus[i % total];
+      while(pool->node_start[node + 1] <= i % total) {
+        node++;
+      }
+      break;
+    case POOL_SCATTER:
+      node = i % pool->n_nodes;
+      cpu = pool->cpus[pool->node_start[node] + (i / pool->n_nodes) % node_size(pool, node)];
+      break;
+    case POOL_NODE:
+      node = i % pool->n_nodes;
+      for(int j = pool->node_start[node]; j < pool->node_start[node + 1]; ++j) {
+        CPU_SET(pool->cpus[j], &thread->cpus);
+      }
+      break;
+  }
+
+  if(cpu >= 0) {
+    CPU_SET(cpu, &thread->cpus);
+  }
+  thread->node = node;
+}
+
+static void *run_thread(void *args) {
+
+  pool_thread *thread = (pool_thread *) args;
+  thread_pool *pool = thread->pool;
+  uint64_t seen = 0;
+
+  if(pool->policy != POOL_UNPINNED) {
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread->cpus);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  for(;;) {
+    while(!pool->stop && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if(pool->stop) {
+      break;
+    }
+    seen = pool->generation;
+    pool_task task = pool->task;
+    void *task_args = pool->args;
+    pthread_mutex_unlock(&pool->lock);
+
+    task(task_args, thread->index, thread->node);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->running == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+thread_pool* create_thread_pool(int n_threads, int policy) {
+
+  if(n_threads <= 0 || policy < POOL_UNPINNED || policy > POOL_NODE) {
+    return NULL;
+  }
+
+  thread_pool *pool = malloc(sizeof(thread_pool));
+  if(pool == NULL) {
+    return NULL;
+  }
+  pool->threads = malloc(n_threads*sizeof(pool_thread));
+  pool->cpus = malloc(CPU_SETSIZE*sizeof(int));
+  if(pool->threads == NULL || pool->cpus == NULL) {
+    free(pool->threads);
+    free(pool->cpus);
+    free(pool);
+    return NULL;
+  }
+
+  pool->n_threads = n_threads;
+  pool->policy = policy;
+  pool->task = NULL;
+  pool->args = NULL;
+  pool->generation = 0;
+  pool->running = 0;
+  pool->stop = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_mutex_init(&pool->run_lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  read_topology(pool);
+
+  for(int i = 0; i < POOL_MAX_NODES; ++i) {
+    pool->leader[i] = -1;
+  }
+
+  for(int i = 0; i < n_threads; ++i) {
+    pool_thread *thread = &pool->threads[i];
+    thread->pool = pool;
+    thread->index = i;
+    place_thread(pool, thread);
+    if(pool->leader[thread->node] < 0) {
+      pool->leader[thread->node] = i;
+    }
+
+    if(pthread_create(&thread->id, NULL, run_thread, thread)) {
+      pool->n_threads = i;
+      free_thread_pool(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+int thread_pool_policy(char *name) {
+
+  char *names[] = {"none", "compact", "scatter", "node"};
+
+  for(int i = POOL_UNPINNED; i <= POOL_NODE; ++i) {
+    if(!strcmp(name, names[i])) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void thread_pool_start(thread_pool *pool, pool_task task, void *args) {
+
+  pthread_mutex_lock(&pool->run_lock);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->args = args;
+  pool->running = pool->n_threads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_wait(thread_pool *pool) {
+
+  pthread_mutex_lock(&pool->lock);
+  while(pool->running > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_unlock(&pool->run_lock);
+}
+
+void thread_pool_run(thread_pool *pool, pool_task task, void *args) {
+
+  thread_pool_start(pool, task, args);
+  thread_pool_wait(pool);
+}
+
+int thread_pool_size(thread_pool *pool) {
+  return pool->n_threads;
+}
+
+int thread_pool_nodes(thread_pool *pool) {
+  return pool->n_nodes;
+}
+
+void free_thread_pool(thread_pool *pool) {
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(int i = 0; i < pool->n_threads; ++i) {
+    pthread_join(pool->threads[i].id, NULL);
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->run_lock);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->cpus);
+  free(pool->threads);
+  free(pool);
+  pool = NULL;
+}
+
+// The first thread of each node writes the copy, the pages are local to it
+static void copy_to_node(void *args, int thread, int node) {
+
+  replica_args *values = (replica_args *) args;
+
+  if(values->pool->leader[node] != thread) {
+    return;
+  }
+
+  void *copy = alloc_pages(values->replica->size, ALLOC_DEFAULT);
+  if(copy != NULL) {
+    memcpy(copy, values->data, values->replica->size);
+    values->replica->copies[node] = copy;
+    values->replica->owned[node] = 1;
+  }
+}
+
+replica_t* create_replica(thread_pool *pool, void *data, size_t size) {
+
+  replica_t *replica = malloc(sizeof(replica_t));
+  if(replica == NULL) {
+    return NULL;
+  }
+
+  replica->n_nodes = pool->n_nodes;
+  replica->size = size;
+  for(int i = 0; i < POOL_MAX_NODES; ++i) {
+    replica->copies[i] = NULL;
+    replica->owned[i] = 0;
+  }
+
+  replica_args values = {pool, replica, data};
+  thread_pool_run(pool, copy_to_node, &values);
+
+  // Nodes without threads, or whose copy failed, share one
+  void *shared = NULL;
+  for(int i = 0; i < replica->n_nodes && shared == NULL; ++i) {
+    shared = replica->copies[i];
+  }
+  if(shared == NULL) {
+    shared = alloc_pages(size, ALLOC_DEFAULT);
+    if(shared == NULL) {
+      free(replica);
+      return NULL;
+    }
+    memcpy(shared, data, size);
+    replica->owned[0] = 1;
+    replica->copies[0] = shared;
+  }
+  for(int i = 0; i < replica->n_nodes; ++i) {
+    if(replica->copies[i] == NULL) {
+      replica->copies[i] = shared;
+    }
+  }
+
+  return replica;
+}
+
+void* get_replica(replica_t *replica, int node) {
+  return replica->copies[node];
+}
+
+void free_replica(replica_t *replica) {
+
+  for(int i = 0; i < replica->n_nodes; ++i) {
+    if(replica->owned[i]) {
+      free_pages(replica->copies[i], replica->size, ALLOC_DEFAULT);
+    }
+  }
+  free(replica);
+  replica = NULL;
+}
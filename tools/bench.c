@@ -0,0 +1,728 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "signature_attack.h"
+#include "sharded_signer.h"
+#include "thread_pool.h"
+
+/*
+ *  Purpose:
+ *      Benchmarks of the signature, the merkle tree, the sharded signer and
+ *      the attack. Every measurement is repeated after a few discarded
+ *      warmup runs, the threads are pinned to CPUs by a thread pool
+ *      (compact by default) and the random keys come from a fixed seed, so
+ *      two runs on the same machine can be compared. Results are written
+ *      as CSV or JSON, one row per benchmark and size.
+ *
+ *      With -A it writes an archive for bulk_verify instead: ops
+ *      signatures of one tree and their messages, from the same seed.
+ */
+
+#define FORMAT_CSV 0
+#define FORMAT_JSON 1
+
+// build_tree takes a uint16_t
+#define MAX_TREE_EXPONENT 15
+#define MAX_LEAKED 32
+
+#define OP_KEYGEN 0
+#define OP_SIGN 1
+#define OP_VERIFY 2
+
+typedef struct Options {
+  int warmup;
+  int reps;
+  int format;
+  int min_tree;
+  int max_tree;
+  int max_threads;
+  int ops;
+  int policy;
+  unsigned int seed;
+  unsigned long long int attempts;
+  int leaked[MAX_LEAKED];
+  int n_leaked;
+  char *only;
+  char *archive;
+} options;
+
+typedef struct Samples {
+  double *values;
+  size_t n;
+  size_t capacity;
+} samples;
+
+typedef struct Worker {
+  key *prv;
+  key *pub;
+  uint8_t *sign;
+} worker;
+
+typedef struct Run {
+  int op;
+  int ops;
+  worker *workers;
+  pthread_barrier_t barrier;
+} run_t;
+
+typedef struct Sharded_run {
+  sharded_signer *signer;
+  int ops;
+  double *start;
+  double *end;
+  atomic_int invalid;
+  pthread_barrier_t barrier;
+} sharded_run;
+
+static int rows = 0;
+static long n_cpus = 1;
+
+static double now(void) {
+
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return time.tv_sec + time.tv_nsec/1e9;
+}
+
+static void pin_thread(int cpu) {
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % n_cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void add_sample(samples *s, double value) {
+
+  if(s->n == s->capacity) {
+    s->capacity = s->capacity ? 2*s->capacity : 64;
+    s->values = realloc(s->values, s->capacity*sizeof(double));
+    if(s->values == NULL) {
+      printf("Can't allocate memory for the samples\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->values[s->n++] = value;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static double percentile(samples *s, double p) {
+  return s->values[(size_t) (p*(s->n - 1))];
+}
+
+/*
+ * Prints one row: median, p99, min, max and mean of the samples, then
+ * empties them for the next row.
+ */
+static void report(options *opt, char *bench, long long size, int threads, char *unit, samples *s) {
+
+  if(s->n == 0) {
+    return;
+  }
+
+  qsort(s->values, s->n, sizeof(double), compare_doubles);
+
+  double mean = 0;
+  for(size_t i = 0; i < s->n; ++i) {
+    mean += s->values[i];
+  }
+  mean /= s->n;
+
+  if(opt->format == FORMAT_JSON) {
+    printf("%s  {\"benchmark\": \"%s\", \"size\": %lld, \"threads\": %d, \"unit\": \"%s\", "
+        "\"samples\": %zu, \"median\": %.10g, \"p99\": %.10g, \"min\": %.10g, \"max\": %.10g, "
+        "\"mean\": %.10g}", rows ? ",\n" : "", bench, size, threads, unit, s->n,
+        percentile(s, 0.5), percentile(s, 0.99), s->values[0], s->values[s->n - 1], mean);
+  } else {
+    printf("%s,%lld,%d,%s,%zu,%.10g,%.10g,%.10g,%.10g,%.10g\n", bench, size, threads, unit, s->n,
+        percentile(s, 0.5), percentile(s, 0.99), s->values[0], s->values[s->n - 1], mean);
+  }
+  fflush(stdout);
+
+  rows++;
+  s->n = 0;
+}
+
+// Powers of two, then the maximum itself
+static int next_threads(int threads, int max) {
+  return threads < max && 2*threads > max ? max : 2*threads;
+}
+
+static int selected(options *opt, char *bench) {
+  return opt->only == NULL || strstr(opt->only, bench) != NULL;
+}
+
+static void run_worker(void *args, int thread, int node) {
+
+  run_t *run = (run_t *) args;
+  worker *w = &run->workers[thread];
+  char message[] = "Benchmark message";
+  (void) node;
+
+  GenerateKeys(w->prv, w->pub);
+  Sign(w->prv, message, w->sign);
+
+  pthread_barrier_wait(&run->barrier);
+
+  for(int i = 0; i < run->ops; ++i) {
+    switch(run->op) {
+      case OP_KEYGEN:
+        GenerateKeys(w->prv, w->pub);
+        break;
+      case OP_SIGN:
+        Sign(w->prv, message, w->sign);
+        break;
+      case OP_VERIFY:
+        Verify(w->pub, message, w->sign);
+        break;
+    }
+  }
+
+  pthread_barrier_wait(&run->barrier);
+}
+
+/*
+ * Runs ops operations on each thread and returns the operations per
+ * second of all of them together. The clock only runs between the two
+ * barriers, so key setup and thread creation aren't counted.
+ */
+static double throughput(options *opt, thread_pool *pool, int op) {
+
+  int threads = thread_pool_size(pool);
+  run_t run;
+  run.op = op;
+  run.ops = opt->ops;
+  run.workers = malloc(threads*sizeof(worker));
+  key *keys = malloc(2*threads*sizeof(key));
+  uint8_t *signs = malloc(threads*BlockByteSize*256);
+  if(run.workers == NULL || keys == NULL || signs == NULL) {
+    printf("Can't allocate memory for the workers\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_barrier_init(&run.barrier, NULL, threads + 1);
+
+  for(int i = 0; i < threads; ++i) {
+    run.workers[i].prv = &keys[2*i];
+    run.workers[i].pub = &keys[2*i + 1];
+    run.workers[i].sign = &signs[i*BlockByteSize*256];
+  }
+
+  thread_pool_start(pool, run_worker, &run);
+  pthread_barrier_wait(&run.barrier);
+  double start = now();
+  pthread_barrier_wait(&run.barrier);
+  double seconds = now() - start;
+  thread_pool_wait(pool);
+
+  pthread_barrier_destroy(&run.barrier);
+  free(signs);
+  free(keys);
+  free(run.workers);
+
+  return threads*opt->ops/seconds;
+}
+
+static void bench_lamport(options *opt) {
+
+  char *names[] = {"keygen", "sign", "verify"};
+  samples s = {0};
+
+  for(int threads = 1; threads <= opt->max_threads; threads = next_threads(threads, opt->max_threads)) {
+    thread_pool *pool = create_thread_pool(threads, opt->policy);
+    if(pool == NULL) {
+      printf("Can't start the threads\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for(int op = OP_KEYGEN; op <= OP_VERIFY; ++op) {
+      for(int rep = -opt->warmup; rep < opt->reps; ++rep) {
+        srand(opt->seed + rep);
+        double rate = throughput(opt, pool, op);
+        if(rep >= 0) {
+          add_sample(&s, rate);
+        }
+      }
+      report(opt, names[op], opt->ops, threads, "ops/s", &s);
+    }
+
+    free_thread_pool(pool);
+  }
+
+  free(s.values);
+}
+
+static void bench_tree(options *opt) {
+
+  samples build = {0}, memory = {0}, sign = {0}, verify = {0};
+  char message[sizeof("Benchmark message 00000")];
+
+  if(opt->policy != POOL_UNPINNED) {
+    pin_thread(0);
+  }
+
+  for(int exponent = opt->min_tree; exponent <= opt->max_tree; ++exponent) {
+    uint16_t n = (uint16_t) (1 << exponent);
+
+    for(int rep = -opt->warmup; rep < opt->reps; ++rep) {
+      srand(opt->seed + rep);
+
+      double start = now();
+      tree_t *tree = build_tree(n);
+      double seconds = now() - start;
+
+      size_t live, reclaimed;
+      get_tree_memory(tree, &live, &reclaimed);
+
+      uint8_t *pub = get_public_hash(tree);
+
+      for(int i = 0; i < n; ++i) {
+        snprintf(message, sizeof(message), "Benchmark message %d", i);
+
+        start = now();
+        merkle_sign *signature = merkle_signature(tree, message);
+        double sign_time = now() - start;
+
+        start = now();
+        uint8_t valid = verify_prove(pub, message, signature);
+        double verify_time = now() - start;
+
+        if(!valid) {
+          printf("The benchmark signature isn't valid\n");
+          exit(EXIT_FAILURE);
+        }
+        free_merkle_signature(signature);
+
+        if(rep >= 0) {
+          add_sample(&sign, sign_time*1e9);
+          add_sample(&verify, verify_time*1e9);
+        }
+      }
+
+      free_tree(tree);
+
+      if(rep >= 0) {
+        add_sample(&build, seconds);
+        add_sample(&memory, live);
+      }
+    }
+
+    report(opt, "tree_build", n, 1, "s", &build);
+    report(opt, "tree_memory", n, 1, "bytes", &memory);
+    report(opt, "merkle_sign", n, 1, "ns", &sign);
+    report(opt, "merkle_verify", n, 1, "ns", &verify);
+  }
+
+  free(build.values);
+  free(memory.values);
+  free(sign.values);
+  free(verify.values);
+}
+
+// Each thread signs from its own shard, the first signature is checked
+static void run_sharded(void *args, int thread, int node) {
+
+  sharded_run *run = (sharded_run *) args;
+  char message[] = "Benchmark message";
+  merkle_sign *first = NULL;
+  (void) node;
+
+  pthread_barrier_wait(&run->barrier);
+  run->start[thread] = now();
+
+  for(int i = 0; i < run->ops; ++i) {
+    merkle_sign *signature = sharded_signature(run->signer, (uint16_t) thread, message);
+    if(first == NULL) {
+      first = signature;
+    } else if(signature != NULL) {
+      free_merkle_signature(signature);
+    }
+  }
+
+  run->end[thread] = now();
+  pthread_barrier_wait(&run->barrier);
+
+  if(first == NULL || !verify_prove(get_sharded_public_hash(run->signer), message, first)) {
+    atomic_fetch_add(&run->invalid, 1);
+  }
+  if(first != NULL) {
+    free_merkle_signature(first);
+  }
+}
+
+/*
+ * Signatures per second of threads signing at the same time, one shard
+ * each. The shards are built before the clock starts.
+ */
+static void bench_sharded(options *opt) {
+
+  samples s = {0};
+
+  int leaves = 1;
+  while(leaves < opt->ops && leaves < (1 << MAX_TREE_EXPONENT)) {
+    leaves *= 2;
+  }
+
+  for(int threads = 1; threads <= opt->max_threads; threads = next_threads(threads, opt->max_threads)) {
+    int shards = 1;
+    while(shards < threads) {
+      shards *= 2;
+    }
+
+    thread_pool *pool = create_thread_pool(threads, opt->policy);
+    if(pool == NULL) {
+      printf("Can't start the threads\n");
+      exit(EXIT_FAILURE);
+    }
+
+    double *start = malloc(threads*sizeof(double));
+    double *end = malloc(threads*sizeof(double));
+    if(start == NULL || end == NULL) {
+      printf("Can't allocate memory for the timings\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for(int rep = -opt->warmup; rep < opt->reps; ++rep) {
+      srand(opt->seed + rep);
+
+      sharded_run run;
+      run.signer = build_sharded_signer((uint16_t) shards, (uint16_t) leaves);
+      run.ops = opt->ops < leaves ? opt->ops : leaves;
+      atomic_init(&run.invalid, 0);
+      pthread_barrier_init(&run.barrier, NULL, threads + 1);
+
+      run.start = start;
+      run.end = end;
+
+      thread_pool_start(pool, run_sharded, &run);
+      pthread_barrier_wait(&run.barrier);
+      pthread_barrier_wait(&run.barrier);
+      thread_pool_wait(pool);
+
+      // From the first thread to start to the last one to finish
+      double first = start[0], last = end[0];
+      for(int i = 1; i < threads; ++i) {
+        first = start[i] < first ? start[i] : first;
+        last = end[i] > last ? end[i] : last;
+      }
+      double seconds = last - first;
+
+      pthread_barrier_destroy(&run.barrier);
+      free_sharded_signer(run.signer);
+
+      if(atomic_load(&run.invalid)) {
+        printf("The sharded signature isn't valid\n");
+        exit(EXIT_FAILURE);
+      }
+      if(rep >= 0) {
+        add_sample(&s, threads*run.ops/seconds);
+      }
+    }
+    report(opt, "sharded_sign", shards, threads, "ops/s", &s);
+
+    free(start);
+    free(end);
+    free_thread_pool(pool);
+  }
+
+  free(s.values);
+}
+
+/*
+ * Runs one bounded attack with the library output sent to /dev/null and
+ * returns the hashes per second of the search.
+ */
+static double attack_rate(options *opt, int leaked, int threads) {
+
+  key prv, pub;
+  GenerateKeys(&prv, &pub);
+
+  signatures signs;
+  signs.n = leaked;
+  signs.sign = malloc(leaked*sizeof(uint8_t *));
+  uint8_t *blocks = malloc(leaked*BlockByteSize*256);
+  char message[32];
+  for(int i = 0; i < leaked; ++i) {
+    signs.sign[i] = &blocks[i*BlockByteSize*256];
+    snprintf(message, sizeof(message), "Leaked message %d", i);
+    Sign(&prv, message, signs.sign[i]);
+  }
+
+  uint8_t forged[BlockByteSize*256];
+  char to_forge[] = "Benchmark forgery";
+
+  attackArgs values;
+  values.nThreads = threads;
+  values.pub = &pub;
+  values.signs = &signs;
+  values.message = to_forge;
+  values.forge = forged;
+  values.templates = NULL;
+  values.n_templates = 0;
+  values.max_seconds = 0;
+  values.encoding = NOUNCE_DECIMAL;
+  values.max_attempts = opt->attempts;
+  values.affinity = opt->policy;
+
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+
+  attack_lamport(&values);
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  free(blocks);
+  free(signs.sign);
+
+  return values.seconds > 0 ? values.attempts/values.seconds : 0;
+}
+
+static void bench_attack(options *opt) {
+
+  samples s = {0};
+  char name[32];
+
+  for(int l = 0; l < opt->n_leaked; ++l) {
+    snprintf(name, sizeof(name), "attack_leaked_%d", opt->leaked[l]);
+    for(int threads = 1; threads <= opt->max_threads; threads = next_threads(threads, opt->max_threads)) {
+      for(int rep = -opt->warmup; rep < opt->reps; ++rep) {
+        srand(opt->seed + rep);
+        double rate = attack_rate(opt, opt->leaked[l], threads);
+        if(rep >= 0) {
+          add_sample(&s, rate);
+        }
+      }
+      report(opt, name, opt->attempts, threads, "hashes/s", &s);
+    }
+  }
+
+  free(s.values);
+}
+
+/*
+ * Writes the records of bulk_verify, a 4 byte size and the bytes of the
+ * merkle signature, to prefix.bin and one message per line to prefix.txt,
+ * then prints the public hash of the tree in hexadecimal.
+ */
+static int write_archive(options *opt) {
+
+  int leaves = 1;
+  while(leaves < opt->ops && leaves < (1 << MAX_TREE_EXPONENT)) {
+    leaves *= 2;
+  }
+  int n = opt->ops < leaves ? opt->ops : leaves;
+
+  size_t length = strlen(opt->archive) + sizeof(".bin");
+  char *path = malloc(length);
+  if(path == NULL) {
+    printf("Can't allocate memory for the archive path\n");
+    exit(EXIT_FAILURE);
+  }
+
+  snprintf(path, length, "%s.bin", opt->archive);
+  FILE *signs = fopen(path, "wb");
+  snprintf(path, length, "%s.txt", opt->archive);
+  FILE *messages = fopen(path, "w");
+  free(path);
+  if(signs == NULL || messages == NULL) {
+    perror(opt->archive);
+    return 0;
+  }
+
+  srand(opt->seed);
+  tree_t *tree = build_tree((uint16_t) leaves);
+
+  int ok = 1;
+  char message[32];
+  for(int i = 0; i < n && ok; ++i) {
+    snprintf(message, sizeof(message), "Archived message %d", i);
+    merkle_sign *signature = merkle_signature(tree, message);
+
+    uint16_t size;
+    uint8_t *bytes = get_merkle_sign_bytes(signature, &size);
+    uint32_t record = size;
+    ok = fwrite(&record, sizeof(record), 1, signs) == 1 && fwrite(bytes, size, 1, signs) == 1 &&
+      fprintf(messages, "%s\n", message) > 0;
+    free_merkle_signature(signature);
+  }
+
+  if(ok) {
+    uint8_t *pub = get_public_hash(tree);
+    for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+      printf("%02x", pub[i]);
+    }
+    printf("\n");
+  }
+  free_tree(tree);
+
+  ok = !fclose(signs) && !fclose(messages) && ok;
+  if(!ok) {
+    perror(opt->archive);
+  }
+
+  return ok;
+}
+
+static void usage(char *name) {
+
+  printf("Usage: %s [options]\n"
+      "  -r reps        repetitions per measurement (default 5)\n"
+      "  -w warmup      discarded runs before each measurement (default 1)\n"
+      "  -f csv|json    output format (default csv)\n"
+      "  -t min:max     tree sizes as powers of two, up to %d (default 4:10)\n"
+      "  -p threads     maximum number of threads (default the number of CPUs)\n"
+      "  -n ops         operations per thread in the throughput runs (default 200)\n"
+      "  -l list        leaked signatures of the attack runs (default 1,2,3,4)\n"
+      "  -a attempts    nounces per thread in the attack runs (default 200000)\n"
+      "  -s seed        seed of the keys (default 0)\n"
+      "  -b list        only run these of lamport,tree,sharded,attack\n"
+      "  -P policy      pinning of the threads: none, compact, scatter or\n"
+      "                 node (default compact)\n"
+      "  -A prefix      write ops signatures of one tree to prefix.bin and\n"
+      "                 their messages to prefix.txt for bulk_verify, print\n"
+      "                 the public hash and exit\n", name, MAX_TREE_EXPONENT);
+}
+
+int main(int argc, char **argv) {
+
+  n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if(n_cpus < 1) {
+    n_cpus = 1;
+  }
+
+  options opt;
+  opt.warmup = 1;
+  opt.reps = 5;
+  opt.format = FORMAT_CSV;
+  opt.min_tree = 4;
+  opt.max_tree = 10;
+  opt.max_threads = (int) n_cpus;
+  opt.ops = 200;
+  opt.policy = POOL_COMPACT;
+  opt.seed = 0;
+  opt.attempts = 200000;
+  opt.n_leaked = 4;
+  for(int i = 0; i < opt.n_leaked; ++i) {
+    opt.leaked[i] = i + 1;
+  }
+  opt.only = NULL;
+  opt.archive = NULL;
+
+  int c;
+  char *list;
+  while((c = getopt(argc, argv, "r:w:f:t:p:n:l:a:s:b:P:A:h")) != -1) {
+    switch(c) {
+      case 'r':
+        opt.reps = atoi(optarg);
+        break;
+      case 'w':
+        opt.warmup = atoi(optarg);
+        break;
+      case 'f':
+        opt.format = strcmp(optarg, "json") ? FORMAT_CSV : FORMAT_JSON;
+        break;
+      case 't':
+        if(sscanf(optarg, "%d:%d", &opt.min_tree, &opt.max_tree) != 2) {
+          opt.max_tree = opt.min_tree;
+        }
+        break;
+      case 'p':
+        opt.max_threads = atoi(optarg);
+        break;
+      case 'n':
+        opt.ops = atoi(optarg);
+        break;
+      case 'l':
+        opt.n_leaked = 0;
+        for(list = strtok(optarg, ","); list != NULL && opt.n_leaked < MAX_LEAKED;
+            list = strtok(NULL, ",")) {
+          opt.leaked[opt.n_leaked++] = atoi(list);
+        }
+        break;
+      case 'a':
+        opt.attempts = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        opt.seed = (unsigned int) strtoul(optarg, NULL, 10);
+        break;
+      case 'b':
+        opt.only = optarg;
+        break;
+      case 'P':
+        opt.policy = thread_pool_policy(optarg);
+        break;
+      case 'A':
+        opt.archive = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(opt.reps < 1 || opt.policy < 0 || opt.warmup < 0 || opt.max_threads < 1 || opt.ops < 1 ||
+      opt.attempts < 1 || opt.min_tree < 0 || opt.min_tree > opt.max_tree ||
+      opt.max_tree > MAX_TREE_EXPONENT) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  for(int i = 0; i < opt.n_leaked; ++i) {
+    if(opt.leaked[i] < 1 || opt.leaked[i] > 255) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(opt.archive != NULL) {
+    return write_archive(&opt) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if(opt.format == FORMAT_JSON) {
+    printf("[\n");
+  } else {
+    printf("benchmark,size,threads,unit,samples,median,p99,min,max,mean\n");
+  }
+
+  if(selected(&opt, "lamport")) {
+    bench_lamport(&opt);
+  }
+  if(selected(&opt, "tree")) {
+    bench_tree(&opt);
+  }
+  if(selected(&opt, "sharded")) {
+    bench_sharded(&opt);
+  }
+  if(selected(&opt, "attack")) {
+    bench_attack(&opt);
+  }
+
+  if(opt.format == FORMAT_JSON) {
+    printf("\n]\n");
+  }
+
+  return 0;
+}
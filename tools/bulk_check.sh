@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Smoke check of bulk_verify on an archive written by bench -A: the whole
+# archive verifies, a record with a changed byte is invalid and a record
+# cut short is malformed.
+
+BUILD_DIR=${BUILD_DIR:-build}
+RECORDS=64
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+fail() {
+  echo "bulk_check: $1"
+  exit 1
+}
+
+PUB=$("$BUILD_DIR/bench" -A "$DIR/archive" -n $RECORDS) || fail "can't write the archive"
+
+"$BUILD_DIR/bulk_verify" -p "$PUB" "$DIR/archive.bin" "$DIR/archive.txt" > "$DIR/good" 2>/dev/null ||
+  fail "the archive doesn't verify"
+[ "$(grep -c "	valid$" "$DIR/good")" -eq $RECORDS ] || fail "not every record is valid"
+
+# Every record of one tree has the same size, flip the first Lamport byte of record 3
+SIZE=$(od -An -tu4 -N4 "$DIR/archive.bin" | tr -d ' ')
+OFFSET=$((3*(4 + SIZE) + 4))
+cp "$DIR/archive.bin" "$DIR/tampered.bin"
+BYTE=$(od -An -tu1 -j $OFFSET -N1 "$DIR/archive.bin" | tr -d ' ')
+printf "\\$(printf '%03o' $((BYTE ^ 1)))" |
+  dd of="$DIR/tampered.bin" bs=1 seek=$OFFSET conv=notrunc 2>/dev/null
+
+if "$BUILD_DIR/bulk_verify" -p "$PUB" "$DIR/tampered.bin" "$DIR/archive.txt" > "$DIR/tampered" 2>/dev/null; then
+  fail "the tampered archive verifies"
+fi
+grep -q "^3	invalid$" "$DIR/tampered" || fail "the tampered record isn't invalid"
+[ "$(grep -c "	valid$" "$DIR/tampered")" -eq $((RECORDS - 1)) ] || fail "other records changed"
+
+# The last record loses its last bytes
+head -c $((RECORDS*(4 + SIZE) - 10)) "$DIR/archive.bin" > "$DIR/truncated.bin"
+
+if "$BUILD_DIR/bulk_verify" -p "$PUB" "$DIR/truncated.bin" "$DIR/archive.txt" > "$DIR/truncated" 2>/dev/null; then
+  fail "the truncated archive verifies"
+fi
+grep -q "^$((RECORDS - 1))	malformed$" "$DIR/truncated" || fail "the truncated record isn't malformed"
+
+echo "bulk_check: $RECORDS records valid, tampered record invalid, truncated record malformed"
@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "proof_cache.h"
+#include "thread_pool.h"
+
+/*
+ *  Purpose:
+ *      Verifies an archive of merkle signatures against one public hash.
+ *      Both files are mapped, never read into memory: the main thread
+ *      walks them once, front to back, cutting the records into chunks
+ *      while the worker threads verify the chunks it already cut. Each
+ *      worker owns a proof cache, so the upper nodes shared by the
+ *      signatures of a tree are hashed once per worker instead of once
+ *      per signature. The workers are pinned by a thread pool and read
+ *      the public hash from a copy on their own NUMA node.
+ *
+ *  Signature file:
+ *      |size (4 bytes)|merkle signature| ... one record per signature ...|
+ *
+ *  Message file:
+ *      One message per line, in the order of the signatures, without the
+ *      ending newline.
+ *
+ *  Output:
+ *      One line per record, "index<TAB>valid|invalid|malformed", chunk by
+ *      chunk as they're done (so not always in order), then a summary on
+ *      stderr.
+ */
+
+#define CHUNK_RECORDS 256
+#define QUEUE_DEPTH 4
+#define DEFAULT_CACHE 65536
+#define RESULT_LINE 40
+
+#define RECORD_VALID 0
+#define RECORD_INVALID 1
+#define RECORD_MALFORMED 2
+
+typedef struct Mapped_file {
+  uint8_t *data;
+  size_t size;
+} mapped_file;
+
+typedef struct Chunk {
+  uint64_t first;
+  int n;
+  uint8_t *sign[CHUNK_RECORDS];
+  uint32_t sign_size[CHUNK_RECORDS];
+  char *message[CHUNK_RECORDS];
+  size_t message_size[CHUNK_RECORDS];
+} chunk_t;
+
+typedef struct Worker {
+  uint64_t results[3];
+  uint64_t hits;
+  uint64_t misses;
+} worker;
+
+typedef struct Verifier {
+  replica_t *pub;
+  uint32_t cache_nodes;
+  int quiet;
+  worker *workers;
+
+  chunk_t **queue;
+  int queue_capacity;
+  int head;
+  int count;
+  int done;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t room;
+  pthread_mutex_t output;
+} verifier;
+
+static char *result_names[] = {"valid", "invalid", "malformed"};
+
+static int map_file(char *path, mapped_file *file) {
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st)) {
+    close(fd);
+    return 0;
+  }
+
+  file->size = st.st_size;
+  file->data = NULL;
+  if(file->size > 0) {
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(file->data == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+    madvise(file->data, file->size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  return 1;
+}
+
+static void push_chunk(verifier *v, chunk_t *chunk) {
+
+  pthread_mutex_lock(&v->lock);
+  while(v->count == v->queue_capacity) {
+    pthread_cond_wait(&v->room, &v->lock);
+  }
+  v->queue[(v->head + v->count) % v->queue_capacity] = chunk;
+  v->count++;
+  pthread_cond_signal(&v->ready);
+  pthread_mutex_unlock(&v->lock);
+}
+
+// Returns NULL once the producer is done and the queue is empty
+static chunk_t* pop_chunk(verifier *v) {
+
+  chunk_t *chunk = NULL;
+
+  pthread_mutex_lock(&v->lock);
+  while(v->count == 0 && !v->done) {
+    pthread_cond_wait(&v->ready, &v->lock);
+  }
+  if(v->count > 0) {
+    chunk = v->queue[v->head];
+    v->head = (v->head + 1) % v->queue_capacity;
+    v->count--;
+    pthread_cond_signal(&v->room);
+  }
+  pthread_mutex_unlock(&v->lock);
+
+  return chunk;
+}
+
+static void verify_chunks(void *args, int thread, int node) {
+
+  verifier *v = (verifier *) args;
+  worker *w = &v->workers[thread];
+  uint8_t *pub = get_replica(v->pub, node);
+
+  proof_cache *cache = create_proof_cache(v->cache_nodes);
+  char *output = malloc(CHUNK_RECORDS*RESULT_LINE);
+  if(cache == NULL || output == NULL) {
+    fprintf(stderr, "Can't allocate memory for the worker\n");
+    exit(2);
+  }
+
+  merkle_sign *signature = NULL;
+  char *message = NULL;
+  size_t message_capacity = 0;
+  chunk_t *chunk;
+
+  while((chunk = pop_chunk(v)) != NULL) {
+    size_t length = 0;
+
+    for(int i = 0; i < chunk->n; ++i) {
+      int result = RECORD_MALFORMED;
+
+      // Sign hashes a C string, a message with a '\0' was never signed
+      if(chunk->sign[i] != NULL && chunk->message[i] != NULL && chunk->sign_size[i] <= UINT16_MAX &&
+          memchr(chunk->message[i], '\0', chunk->message_size[i]) == NULL) {
+        if(message_capacity < chunk->message_size[i] + 1) {
+          message_capacity = 2*(chunk->message_size[i] + 1);
+          message = realloc(message, message_capacity);
+          if(message == NULL) {
+            fprintf(stderr, "Can't allocate memory for the message\n");
+            exit(2);
+          }
+        }
+        memcpy(message, chunk->message[i], chunk->message_size[i]);
+        message[chunk->message_size[i]] = '\0';
+
+        signature = copy_merkle_signature(signature, chunk->sign[i], (uint16_t) chunk->sign_size[i]);
+        result = verify_prove_cached(cache, pub, message, signature) ? RECORD_VALID : RECORD_INVALID;
+      }
+
+      w->results[result]++;
+      if(!v->quiet) {
+        length += snprintf(output + length, RESULT_LINE, "%llu\t%s\n",
+            (unsigned long long) (chunk->first + i), result_names[result]);
+      }
+    }
+
+    if(length > 0) {
+      pthread_mutex_lock(&v->output);
+      fwrite(output, 1, length, stdout);
+      pthread_mutex_unlock(&v->output);
+    }
+
+    free(chunk);
+  }
+
+  uint64_t evictions;
+  proof_cache_stats(cache, &w->hits, &w->misses, &evictions);
+
+  if(signature != NULL) {
+    free_merkle_signature(signature);
+  }
+  free(message);
+  free(output);
+  free_proof_cache(cache);
+}
+
+/*
+ * Walks both files once and hands the records to the workers. A record
+ * whose size runs past the end of the file ends the archive.
+ */
+static uint64_t cut_records(verifier *v, mapped_file *signs, mapped_file *messages) {
+
+  size_t sign_position = 0, message_position = 0;
+  uint64_t records = 0;
+  chunk_t *chunk = NULL;
+
+  while(sign_position < signs->size) {
+    if(chunk == NULL) {
+      chunk = malloc(sizeof(chunk_t));
+      if(chunk == NULL) {
+        fprintf(stderr, "Can't allocate memory for the records\n");
+        exit(2);
+      }
+      chunk->first = records;
+      chunk->n = 0;
+    }
+
+    int i = chunk->n++;
+    uint32_t size = 0;
+    int truncated = signs->size - sign_position < sizeof(uint32_t);
+    if(!truncated) {
+      memcpy(&size, signs->data + sign_position, sizeof(uint32_t));
+      truncated = signs->size - sign_position - sizeof(uint32_t) < size;
+    }
+
+    chunk->sign[i] = truncated ? NULL : signs->data + sign_position + sizeof(uint32_t);
+    chunk->sign_size[i] = size;
+    sign_position = truncated ? signs->size : sign_position + sizeof(uint32_t) + size;
+
+    chunk->message[i] = NULL;
+    if(message_position < messages->size) {
+      char *line = (char *) messages->data + message_position;
+      char *end = memchr(line, '\n', messages->size - message_position);
+      chunk->message[i] = line;
+      chunk->message_size[i] = end != NULL ? (size_t) (end - line) : messages->size - message_position;
+      message_position += chunk->message_size[i] + 1;
+    }
+
+    records++;
+    if(chunk->n == CHUNK_RECORDS) {
+      push_chunk(v, chunk);
+      chunk = NULL;
+    }
+  }
+
+  if(chunk != NULL) {
+    push_chunk(v, chunk);
+  }
+
+  pthread_mutex_lock(&v->lock);
+  v->done = 1;
+  pthread_cond_broadcast(&v->ready);
+  pthread_mutex_unlock(&v->lock);
+
+  return records;
+}
+
+static int parse_hex(char *hex, uint8_t *out) {
+
+  if(strlen(hex) != 2*SHA256_DIGEST_LENGTH) {
+    return 0;
+  }
+
+  for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+    unsigned int byte;
+    if(sscanf(hex + 2*i, "%2x", &byte) != 1) {
+      return 0;
+    }
+    out[i] = (uint8_t) byte;
+  }
+
+  return 1;
+}
+
+static void usage(char *name) {
+
+  fprintf(stderr, "Usage: %s -p public_hash [options] signatures messages\n"
+      "  -p hash        public hash of the tree, in hexadecimal\n"
+      "  -j threads     verifying threads (default the number of CPUs)\n"
+      "  -c nodes       proof cache of each thread (default %d nodes)\n"
+      "  -a policy      pinning of the threads: none, compact, scatter or\n"
+      "                 node (default compact)\n"
+      "  -q             only print the summary\n", name, DEFAULT_CACHE);
+}
+
+int main(int argc, char **argv) {
+
+  verifier v;
+  memset(&v, 0, sizeof(v));
+  v.cache_nodes = DEFAULT_CACHE;
+
+  long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int policy = POOL_COMPACT;
+  uint8_t pub[SHA256_DIGEST_LENGTH];
+  int has_pub = 0;
+
+  int c;
+  while((c = getopt(argc, argv, "p:j:c:a:qh")) != -1) {
+    switch(c) {
+      case 'p':
+        has_pub = parse_hex(optarg, pub);
+        break;
+      case 'a':
+        policy = thread_pool_policy(optarg);
+        break;
+      case 'j':
+        n_threads = atol(optarg);
+        break;
+      case 'c':
+        v.cache_nodes = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'q':
+        v.quiet = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return c == 'h' ? EXIT_SUCCESS : 2;
+    }
+  }
+
+  if(!has_pub || n_threads < 1 || v.cache_nodes < 1 || policy < 0 || argc - optind != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  mapped_file signs, messages;
+  if(!map_file(argv[optind], &signs)) {
+    perror(argv[optind]);
+    return 2;
+  }
+  if(!map_file(argv[optind + 1], &messages)) {
+    perror(argv[optind + 1]);
+    return 2;
+  }
+
+  thread_pool *pool = create_thread_pool((int) n_threads, policy);
+  v.queue_capacity = QUEUE_DEPTH*n_threads;
+  v.queue = malloc(v.queue_capacity*sizeof(chunk_t *));
+  v.workers = calloc(n_threads, sizeof(worker));
+  if(pool == NULL || v.queue == NULL || v.workers == NULL) {
+    fprintf(stderr, "Can't start the threads\n");
+    return 2;
+  }
+  v.pub = create_replica(pool, pub, SHA256_DIGEST_LENGTH);
+  if(v.pub == NULL) {
+    fprintf(stderr, "Can't allocate memory for the public hash\n");
+    return 2;
+  }
+  pthread_mutex_init(&v.lock, NULL);
+  pthread_mutex_init(&v.output, NULL);
+  pthread_cond_init(&v.ready, NULL);
+  pthread_cond_init(&v.room, NULL);
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  thread_pool_start(pool, verify_chunks, &v);
+
+  uint64_t records = cut_records(&v, &signs, &messages);
+
+  thread_pool_wait(pool);
+
+  uint64_t results[3] = {0}, hits = 0, misses = 0;
+  for(int i = 0; i < n_threads; ++i) {
+    for(int j = 0; j < 3; ++j) {
+      results[j] += v.workers[i].results[j];
+    }
+    hits += v.workers[i].hits;
+    misses += v.workers[i].misses;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)/1e9;
+  fflush(stdout);
+
+  fprintf(stderr, "records %llu, valid %llu, invalid %llu, malformed %llu\n",
+      (unsigned long long) records, (unsigned long long) results[RECORD_VALID],
+      (unsigned long long) results[RECORD_INVALID], (unsigned long long) results[RECORD_MALFORMED]);
+  fprintf(stderr, "%.3fs with %ld threads, %.0f records/s, %.1f MB/s, cache hits %llu, misses %llu\n",
+      seconds, n_threads, records/seconds, (signs.size + messages.size)/seconds/1e6,
+      (unsigned long long) hits, (unsigned long long) misses);
+
+  pthread_cond_destroy(&v.room);
+  pthread_cond_destroy(&v.ready);
+  pthread_mutex_destroy(&v.output);
+  pthread_mutex_destroy(&v.lock);
+  free_replica(v.pub);
+  free_thread_pool(pool);
+  free(v.workers);
+  free(v.queue);
+  if(signs.data != NULL) {
+    munmap(signs.data, signs.size);
+  }
+  if(messages.data != NULL) {
+    munmap(messages.data, messages.size);
+  }
+
+  return results[RECORD_VALID] == records ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,925 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "signature.h"
+#include "merkle_tree.h"
+#include "hypertree.h"
+#include "reuse_index.h"
+#include "signer_protocol.h"
+#include "stats.h"
+
+/*
+ *  Purpose:
+ *      Signing daemon. It owns one hypertree and answers the requests of
+ *      signer_protocol.h on a Unix socket, from a single epoll loop.
+ *
+ *      Requests that arrive together are handled as one batch: every
+ *      message of the batch is signed or verified in one pass, the leaves
+ *      that signed, in every layer, are appended to the journal with a
+ *      single fdatasync, and only then the responses go out. A signature
+ *      never leaves the daemon before its leaves are on disk. A batch is
+ *      closed as soon as the ready sockets are drained or it's full, so
+ *      waiting for company never adds latency.
+ *
+ *      The keys come from the seed only, so a restart with the same seed
+ *      builds the same trees in the same order. The bottom leaves in the
+ *      journal are skipped, and a leaf of an upper layer may only sign
+ *      again the root it signed before. The seed is read from a file only
+ *      its owner can read, made with getrandom the first time, and a
+ *      journal with leaves is refused without it.
+ *
+ *      While no request is waiting the loop prepares the public key and
+ *      path of the next leaves one at a time, polling the socket between
+ *      each, so a sign request only has to sign its message.
+ */
+
+#define MAX_EVENTS 64
+#define DEFAULT_BATCH 64
+#define DEFAULT_LOOKAHEAD 16
+#define READ_SIZE 65536
+// A leaf hash and the hash of the Lamport signature it made
+#define JOURNAL_RECORD (2*SHA256_DIGEST_LENGTH)
+// Stop reading from a client that doesn't read its responses
+#define OUT_LIMIT (4*SIGNER_MAX_PAYLOAD)
+
+typedef struct Buffer {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} buffer;
+
+typedef struct Connection connection;
+
+struct Connection {
+  int fd;
+  buffer in;
+  size_t in_start;
+  buffer out;
+  size_t out_sent;
+  uint32_t events;
+  int pending;
+  int backlog;
+  int eof;
+  int closing;
+  connection *next;
+};
+
+typedef struct Request {
+  connection *conn;
+  uint8_t op;
+  uint8_t status;
+  uint32_t id;
+  char *message;
+  uint8_t *sign;
+  uint32_t sign_size;
+  hyper_sign *signature;
+} request;
+
+typedef struct Signer {
+  hypertree *tree;
+  uint8_t pub[SHA256_DIGEST_LENGTH];
+  reuse_index *used;
+  reuse_index *signs;
+  int layers;
+  // Set when signing can't go on safely, the daemon stops
+  int failed;
+  int journal;
+  int epoll;
+  int listener;
+  connection *connections;
+  request *batch;
+  int n_batch;
+  int max_batch;
+  uint8_t *records;
+} signer;
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_stop(int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+static int reserve(buffer *b, size_t size) {
+
+  if(b->size + size <= b->capacity) {
+    return 1;
+  }
+
+  size_t capacity = b->capacity ? b->capacity : 4096;
+  while(capacity < b->size + size) {
+    capacity *= 2;
+  }
+
+  uint8_t *data = realloc(b->data, capacity);
+  if(data == NULL) {
+    return 0;
+  }
+  b->data = data;
+  b->capacity = capacity;
+
+  return 1;
+}
+
+/*
+ * The leaf says the key was used, the hash of the whole record which
+ * Lamport signature it made, and so which message it signed.
+ */
+static int insert_record(signer *s, uint8_t *record) {
+
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  SHA256(record, JOURNAL_RECORD, hash);
+
+  if(reuse_index_insert(s->signs, hash) == INDEX_ERROR) {
+    return INDEX_ERROR;
+  }
+
+  return reuse_index_insert(s->used, record);
+}
+
+/*
+ * Reads the leaves of earlier runs, so they're never handed out again.
+ * A journal that doesn't hold whole records is refused: past a cut record
+ * every other one would be read shifted, and its leaves handed out again.
+ */
+static int open_journal(signer *s, char *path, uint64_t *records) {
+
+  s->journal = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+  if(s->journal < 0) {
+    return 0;
+  }
+
+  struct stat st;
+  if(fstat(s->journal, &st)) {
+    return 0;
+  }
+
+  if(st.st_size % JOURNAL_RECORD) {
+    fprintf(stderr, "%s doesn't hold whole records, it may be damaged\n", path);
+    errno = EINVAL;
+    return 0;
+  }
+
+  *records = st.st_size / JOURNAL_RECORD;
+  s->used = create_reuse_index(*records, NULL);
+  s->signs = create_reuse_index(*records, NULL);
+  if(s->used == NULL || s->signs == NULL) {
+    return 0;
+  }
+
+  uint8_t record[JOURNAL_RECORD];
+  for(uint64_t i = 0; i < *records; ++i) {
+    if(pread(s->journal, record, JOURNAL_RECORD, i*JOURNAL_RECORD) != JOURNAL_RECORD ||
+        insert_record(s, record) == INDEX_ERROR) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Appends the records of a batch. When a write or the sync fails the
+ * journal is cut back to where the batch started, so the next batch
+ * still starts on a whole record.
+ */
+static int commit_journal(signer *s, int n_records) {
+
+  size_t size = (size_t) n_records*JOURNAL_RECORD;
+  uint8_t *position = s->records;
+
+  struct stat st;
+  if(fstat(s->journal, &st)) {
+    return 0;
+  }
+
+  while(size > 0) {
+    ssize_t written = write(s->journal, position, size);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    position += written;
+    size -= written;
+  }
+
+  if(size == 0 && !fdatasync(s->journal)) {
+    return 1;
+  }
+
+  int error = errno;
+  if(ftruncate(s->journal, st.st_size) || fdatasync(s->journal)) {
+    fprintf(stderr, "Can't cut the journal back to a whole record, stopping\n");
+    s->failed = 1;
+    stop = 1;
+  }
+  errno = error;
+
+  return 0;
+}
+
+/*
+ * Makes the new seed file durable in its directory.
+ */
+static int sync_directory(char *path) {
+
+  char *copy = strdup(path);
+  if(copy == NULL) {
+    return 0;
+  }
+
+  int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+  int ret = fd >= 0 && !fsync(fd);
+  if(fd >= 0) {
+    close(fd);
+  }
+  free(copy);
+
+  return ret;
+}
+
+/*
+ * Reads the seed of the keys from its file. Without the file a new seed
+ * comes from getrandom and is written there, only readable by the owner,
+ * unless the journal already has leaves: they belong to another seed.
+ */
+static int load_seed(char *path, uint64_t records, uint8_t *seed) {
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd >= 0) {
+    struct stat st;
+    ssize_t n = 0;
+    if(fstat(fd, &st) == 0 && !(st.st_mode & 077)) {
+      n = read(fd, seed, SHA256_DIGEST_LENGTH);
+    }
+    close(fd);
+    if(n != SHA256_DIGEST_LENGTH) {
+      printf("%s must hold %d bytes and be readable only by its owner\n", path, SHA256_DIGEST_LENGTH);
+      return 0;
+    }
+    return 1;
+  }
+
+  if(errno != ENOENT) {
+    perror(path);
+    return 0;
+  }
+  if(records > 0) {
+    printf("The journal already has leaves but %s is missing\n", path);
+    return 0;
+  }
+
+  if(getrandom(seed, SHA256_DIGEST_LENGTH, 0) != SHA256_DIGEST_LENGTH) {
+    perror("getrandom");
+    return 0;
+  }
+
+  fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  int ret = fd >= 0 && write(fd, seed, SHA256_DIGEST_LENGTH) == SHA256_DIGEST_LENGTH && !fsync(fd);
+  if(fd >= 0) {
+    close(fd);
+  }
+  if(!ret || !sync_directory(path)) {
+    perror(path);
+    unlink(path);
+    explicit_bzero(seed, SHA256_DIGEST_LENGTH);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int open_listener(char *path) {
+
+  struct sockaddr_un address;
+  if(strlen(path) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return -1;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  unlink(path);
+
+  // Only the owner of the daemon can ask for signatures
+  mode_t mask = umask(077);
+  int bound = bind(fd, (struct sockaddr *) &address, sizeof(address));
+  umask(mask);
+
+  if(bound || listen(fd, SOMAXCONN)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void close_connection(signer *s, connection *conn) {
+
+  if(!conn->closing) {
+    epoll_ctl(s->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->closing = 1;
+  }
+}
+
+/*
+ * Reads from the socket unless the responses are piling up, and writes
+ * while there's something to write. A client that stopped sending is
+ * closed once everything it asked for was answered.
+ */
+static void update_events(signer *s, connection *conn) {
+
+  if(conn->closing) {
+    return;
+  }
+
+  uint32_t events = 0;
+  size_t waiting = conn->out.size - conn->out_sent;
+  if(conn->eof && !waiting && !conn->pending && !conn->backlog) {
+    close_connection(s, conn);
+    return;
+  }
+  if(waiting < OUT_LIMIT && !conn->eof) {
+    events |= EPOLLIN;
+  }
+  if(waiting > 0) {
+    events |= EPOLLOUT;
+  }
+
+  if(events != conn->events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = conn;
+    epoll_ctl(s->epoll, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = events;
+  }
+}
+
+static void accept_connections(signer *s) {
+
+  int fd;
+  while((fd = accept4(s->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    connection *conn = calloc(1, sizeof(connection));
+    if(conn == NULL) {
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->events = EPOLLIN;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if(epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &event)) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+
+    conn->next = s->connections;
+    s->connections = conn;
+  }
+}
+
+/*
+ * Moves the complete requests of a connection to the batch. When the
+ * batch fills up the rest waits in the buffer for the next one.
+ */
+static void parse_requests(signer *s, connection *conn) {
+
+  conn->backlog = 0;
+
+  while(!conn->closing && conn->in.size - conn->in_start >= SIGNER_HEADER_SIZE) {
+    if(s->n_batch == s->max_batch) {
+      conn->backlog = 1;
+      break;
+    }
+
+    uint8_t *header = conn->in.data + conn->in_start;
+    request *req = &s->batch[s->n_batch];
+    uint32_t size;
+
+    req->op = header[0];
+    memcpy(&req->id, header + 1, sizeof(uint32_t));
+    memcpy(&size, header + 5, sizeof(uint32_t));
+
+    if(size > SIGNER_MAX_PAYLOAD || req->op < SIGNER_SIGN || req->op > SIGNER_PUBLIC_KEY) {
+      close_connection(s, conn);
+      break;
+    }
+    if(conn->in.size - conn->in_start < SIGNER_HEADER_SIZE + size) {
+      break;
+    }
+
+    uint8_t *payload = header + SIGNER_HEADER_SIZE;
+    conn->in_start += SIGNER_HEADER_SIZE + size;
+
+    req->conn = conn;
+    req->status = SIGNER_OK;
+    req->message = NULL;
+    req->sign = NULL;
+    req->sign_size = 0;
+    req->signature = NULL;
+
+    // Messages are C strings for Sign, so they can't have a '\0'
+    uint32_t message_size = size;
+    if(req->op == SIGNER_VERIFY) {
+      if(size < sizeof(uint32_t)) {
+        req->status = SIGNER_ERROR;
+      } else {
+        memcpy(&message_size, payload, sizeof(uint32_t));
+        payload += sizeof(uint32_t);
+        size -= sizeof(uint32_t);
+        if(message_size > size) {
+          req->status = SIGNER_ERROR;
+        }
+      }
+    }
+
+    if(req->status == SIGNER_OK && req->op != SIGNER_PUBLIC_KEY) {
+      if(memchr(payload, '\0', message_size) != NULL) {
+        req->status = SIGNER_ERROR;
+      } else if((req->message = malloc(size + 1)) == NULL) {
+        req->status = SIGNER_ERROR;
+      } else {
+        memcpy(req->message, payload, message_size);
+        req->message[message_size] = '\0';
+        req->sign = (uint8_t *) req->message + message_size + 1;
+        req->sign_size = size - message_size;
+        memcpy(req->sign, payload + message_size, req->sign_size);
+      }
+    }
+
+    conn->pending++;
+    s->n_batch++;
+  }
+
+  // Keep the unparsed bytes at the start of the buffer
+  if(conn->in_start > 0) {
+    memmove(conn->in.data, conn->in.data + conn->in_start, conn->in.size - conn->in_start);
+    conn->in.size -= conn->in_start;
+    conn->in_start = 0;
+  }
+}
+
+static void read_requests(signer *s, connection *conn) {
+
+  if(!reserve(&conn->in, READ_SIZE)) {
+    close_connection(s, conn);
+    return;
+  }
+
+  ssize_t n = read(conn->fd, conn->in.data + conn->in.size, READ_SIZE);
+  if(n < 0 && errno != EAGAIN && errno != EINTR) {
+    close_connection(s, conn);
+    return;
+  }
+  if(n == 0) {
+    conn->eof = 1;
+  } else if(n > 0) {
+    conn->in.size += n;
+  }
+
+  parse_requests(s, conn);
+  update_events(s, conn);
+}
+
+static void write_responses(signer *s, connection *conn) {
+
+  while(!conn->closing && conn->out_sent < conn->out.size) {
+    ssize_t n = send(conn->fd, conn->out.data + conn->out_sent, conn->out.size - conn->out_sent,
+        MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno != EAGAIN) {
+        close_connection(s, conn);
+      }
+      break;
+    }
+    conn->out_sent += n;
+  }
+
+  if(conn->out_sent == conn->out.size) {
+    conn->out.size = 0;
+    conn->out_sent = 0;
+  }
+
+  update_events(s, conn);
+}
+
+static void add_response(connection *conn, uint8_t status, uint32_t id, uint8_t *payload, uint32_t size) {
+
+  if(conn->closing || !reserve(&conn->out, SIGNER_HEADER_SIZE + size)) {
+    return;
+  }
+
+  uint8_t *header = conn->out.data + conn->out.size;
+  header[0] = status;
+  memcpy(header + 1, &id, sizeof(uint32_t));
+  memcpy(header + 5, &size, sizeof(uint32_t));
+  if(size > 0) {
+    memcpy(header + SIGNER_HEADER_SIZE, payload, size);
+  }
+  conn->out.size += SIGNER_HEADER_SIZE + size;
+}
+
+/*
+ * Checks the leaves of a signature against the journal and stores the
+ * records of the ones that signed for the first time. The bottom leaf
+ * must be new, the others may only have made the same signature before.
+ */
+static int check_leaves(signer *s, hyper_sign *signature, uint8_t *records, int *n_records) {
+
+  uint8_t leaves[MAX_LAYERS*SHA256_DIGEST_LENGTH], signs[MAX_LAYERS*SHA256_DIGEST_LENGTH];
+
+  if(get_hyper_sign_leaves(signature, leaves, signs) != s->layers) {
+    return INDEX_ERROR;
+  }
+
+  int n = 0;
+  for(int i = 0; i < s->layers; ++i) {
+    uint8_t *record = records + n*JOURNAL_RECORD;
+    memcpy(record, leaves + i*SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH);
+    memcpy(record + SHA256_DIGEST_LENGTH, signs + i*SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH);
+
+    if(i == 0) {
+      int ret = reuse_index_insert(s->used, record);
+      if(ret != KEY_FIRST_USE) {
+        return ret;
+      }
+      n++;
+      continue;
+    }
+
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    SHA256(record, JOURNAL_RECORD, hash);
+    int ret = reuse_index_insert(s->signs, hash);
+    if(ret == KEY_REUSED) {
+      continue;
+    }
+    if(ret == INDEX_ERROR || (ret = reuse_index_insert(s->used, record)) != KEY_FIRST_USE) {
+      // The index now holds the rejected record, nothing can be signed safely
+      if(ret == KEY_REUSED) {
+        fprintf(stderr, "A leaf of layer %d would sign a second root, the seed doesn't match "
+            "the journal, stopping\n", i);
+        s->failed = 1;
+        stop = 1;
+      }
+      return INDEX_ERROR;
+    }
+    n++;
+  }
+
+  *n_records += n;
+
+  return KEY_FIRST_USE;
+}
+
+/*
+ * Signs with the next bottom leaf that isn't in the journal. Returns the
+ * signature and adds the records of its new leaves after the ones of the
+ * batch, or NULL when the keys are over or the leaves can't be checked.
+ */
+static hyper_sign* sign_message(signer *s, char *message, int *n_records) {
+
+  hyper_sign *signature;
+
+  if(s->failed) {
+    return NULL;
+  }
+
+  while((signature = hypertree_signature(s->tree, message)) != NULL) {
+    int ret = check_leaves(s, signature, s->records + *n_records*JOURNAL_RECORD, n_records);
+    if(ret == KEY_FIRST_USE) {
+      break;
+    }
+
+    free_hyper_signature(signature);
+    if(ret == INDEX_ERROR) {
+      return NULL;
+    }
+    fprintf(stderr, "Skipping a leaf that is already in the journal\n");
+  }
+
+  return signature;
+}
+
+static void process_batch(signer *s) {
+
+  int n_records = 0;
+
+  for(int i = 0; i < s->n_batch; ++i) {
+    request *req = &s->batch[i];
+    if(req->status != SIGNER_OK || req->conn->closing) {
+      continue;
+    }
+
+    switch(req->op) {
+      case SIGNER_SIGN:
+        req->signature = sign_message(s, req->message, &n_records);
+        if(req->signature == NULL) {
+          req->status = SIGNER_ERROR;
+        }
+        break;
+      case SIGNER_VERIFY:
+        if(!verify_hyper_prove_bytes(s->pub, req->message, req->sign, req->sign_size)) {
+          req->status = SIGNER_INVALID;
+        }
+        break;
+    }
+  }
+
+  // Without the journal the signatures are dropped, their keys stay secret
+  int committed = n_records == 0 || commit_journal(s, n_records);
+  if(!committed) {
+    fprintf(stderr, "Can't write the journal: %s\n", strerror(errno));
+  }
+
+  for(int i = 0; i < s->n_batch; ++i) {
+    request *req = &s->batch[i];
+    uint8_t *payload = NULL;
+    uint32_t size = 0;
+
+    if(req->signature != NULL && !committed) {
+      req->status = SIGNER_ERROR;
+    }
+
+    if(req->status == SIGNER_OK) {
+      if(req->op == SIGNER_SIGN) {
+        payload = get_hyper_sign_bytes(req->signature, &size);
+      } else if(req->op == SIGNER_PUBLIC_KEY) {
+        payload = s->pub;
+        size = SHA256_DIGEST_LENGTH;
+      }
+    }
+    add_response(req->conn, req->status, req->id, payload, size);
+
+    if(req->signature != NULL) {
+      free_hyper_signature(req->signature);
+    }
+    free(req->message);
+    req->conn->pending--;
+  }
+
+  for(int i = 0; i < s->n_batch; ++i) {
+    connection *conn = s->batch[i].conn;
+    if(conn->out.size > conn->out_sent || conn->eof) {
+      write_responses(s, conn);
+    }
+  }
+
+  s->n_batch = 0;
+}
+
+// Frees the connections that were closed, once no request points to them
+static void sweep_connections(signer *s) {
+
+  connection **link = &s->connections;
+  while(*link != NULL) {
+    connection *conn = *link;
+    if(conn->closing) {
+      *link = conn->next;
+      close(conn->fd);
+      free(conn->in.data);
+      free(conn->out.data);
+      free(conn);
+    } else {
+      link = &conn->next;
+    }
+  }
+}
+
+static void run(signer *s) {
+
+  struct epoll_event events[MAX_EVENTS];
+
+  while(!stop) {
+    // Requests left over by a full batch go first
+    int backlog = 0;
+    for(connection *conn = s->connections; conn != NULL; conn = conn->next) {
+      if(conn->backlog && !conn->closing) {
+        parse_requests(s, conn);
+        backlog |= conn->backlog;
+      }
+    }
+
+    // Idle time goes to the next signatures, until they're all ready
+    int timeout = -1;
+    if(backlog || s->n_batch || hypertree_precompute(s->tree, 1) > 0) {
+      timeout = 0;
+    }
+
+    int n = epoll_wait(s->epoll, events, MAX_EVENTS, timeout);
+    if(n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+
+    for(int i = 0; i < n; ++i) {
+      if(events[i].data.ptr == NULL) {
+        accept_connections(s);
+        continue;
+      }
+
+      connection *conn = events[i].data.ptr;
+      if(events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+        close_connection(s, conn);
+        continue;
+      }
+      if(events[i].events & EPOLLOUT) {
+        write_responses(s, conn);
+      }
+      if(events[i].events & EPOLLIN && !conn->backlog && s->n_batch < s->max_batch) {
+        read_requests(s, conn);
+      }
+    }
+
+    if(s->n_batch > 0) {
+      process_batch(s);
+    }
+    sweep_connections(s);
+  }
+}
+
+static void usage(char *name) {
+
+  printf("Usage: %s [options]\n"
+      "  -S path        socket (default /tmp/lamport-signer.sock)\n"
+      "  -j path        leaf journal (default signer.journal)\n"
+      "  -l layers      layers of the hypertree (default 3)\n"
+      "  -n messages    leaves of each tree (default 256)\n"
+      "  -b batch       most requests in a batch (default %d)\n"
+      "  -L lookahead   signatures of each tree prepared while idle\n"
+      "                 (default %d)\n"
+      "  -w low:high    build trees in the background when a tree has low\n"
+      "                 keys left, keeping up to high ready (default 64:2)\n"
+      "  -k path        file with the %d byte seed of the keys, made from\n"
+      "                 getrandom when missing (default the journal path\n"
+      "                 followed by .seed)\n", name, DEFAULT_BATCH,
+      DEFAULT_LOOKAHEAD, SHA256_DIGEST_LENGTH);
+}
+
+int main(int argc, char **argv) {
+
+  char *socket_path = "/tmp/lamport-signer.sock";
+  char *journal_path = "signer.journal";
+  int layers = 3, n_messages = 256, low_water = 64, high_water = 2;
+  int lookahead = DEFAULT_LOOKAHEAD;
+  char *seed_path = NULL;
+
+  signer s;
+  memset(&s, 0, sizeof(s));
+  s.max_batch = DEFAULT_BATCH;
+
+  int c;
+  while((c = getopt(argc, argv, "S:j:l:n:b:L:w:k:h")) != -1) {
+    switch(c) {
+      case 'S':
+        socket_path = optarg;
+        break;
+      case 'j':
+        journal_path = optarg;
+        break;
+      case 'l':
+        layers = atoi(optarg);
+        break;
+      case 'n':
+        n_messages = atoi(optarg);
+        break;
+      case 'b':
+        s.max_batch = atoi(optarg);
+        break;
+      case 'L':
+        lookahead = atoi(optarg);
+        break;
+      case 'w':
+        if(sscanf(optarg, "%d:%d", &low_water, &high_water) != 2) {
+          high_water = 1;
+        }
+        break;
+      case 'k':
+        seed_path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(layers < 1 || layers > MAX_LAYERS || n_messages < 2 || n_messages > UINT16_MAX ||
+      s.max_batch < 1 || lookahead < 0 || lookahead > UINT16_MAX || low_water < 0 || low_water > UINT16_MAX || high_water < 1 ||
+      high_water > UINT8_MAX) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  s.batch = malloc(s.max_batch*sizeof(request));
+  s.layers = layers;
+  s.records = malloc((size_t) s.max_batch*layers*JOURNAL_RECORD);
+  if(s.batch == NULL || s.records == NULL) {
+    printf("Can't allocate memory for the batch\n");
+    return EXIT_FAILURE;
+  }
+
+  uint64_t records;
+  if(!open_journal(&s, journal_path, &records)) {
+    perror(journal_path);
+    return EXIT_FAILURE;
+  }
+
+  char default_seed_path[PATH_MAX];
+  if(seed_path == NULL) {
+    if(snprintf(default_seed_path, sizeof(default_seed_path), "%s.seed", journal_path) >=
+        (int) sizeof(default_seed_path)) {
+      printf("The journal path is too long\n");
+      return EXIT_FAILURE;
+    }
+    seed_path = default_seed_path;
+  }
+
+  // Other keys would sign other roots with the leaves in the journal
+  uint8_t key_seed[SHA256_DIGEST_LENGTH];
+  if(!load_seed(seed_path, records, key_seed)) {
+    return EXIT_FAILURE;
+  }
+
+  s.tree = build_hypertree_seeded(layers, n_messages, key_seed);
+  explicit_bzero(key_seed, sizeof(key_seed));
+  if(s.tree == NULL || (layers > 1 && !hypertree_use_pipeline(s.tree, low_water, high_water))) {
+    printf("Can't build the hypertree\n");
+    return EXIT_FAILURE;
+  }
+  hypertree_set_lookahead(s.tree, lookahead);
+  memcpy(s.pub, get_hypertree_public_hash(s.tree), SHA256_DIGEST_LENGTH);
+
+  s.listener = open_listener(socket_path);
+  s.epoll = epoll_create1(EPOLL_CLOEXEC);
+  if(s.listener < 0 || s.epoll < 0) {
+    perror(socket_path);
+    return EXIT_FAILURE;
+  }
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(s.epoll, EPOLL_CTL_ADD, s.listener, &event);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("Signing on %s, public hash ", socket_path);
+  for(int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+    printf("%02x", s.pub[i]);
+  }
+  printf("\n");
+  fflush(stdout);
+
+  run(&s);
+
+  for(connection *conn = s.connections; conn != NULL; conn = conn->next) {
+    close_connection(&s, conn);
+  }
+  sweep_connections(&s);
+
+  STATS_DUMP(stderr, STATS_TEXT);
+
+  close(s.epoll);
+  close(s.listener);
+  unlink(socket_path);
+  close(s.journal);
+  free_reuse_index(s.used);
+  free_reuse_index(s.signs);
+  free_hypertree(s.tree);
+  free(s.records);
+  free(s.batch);
+
+  return s.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}